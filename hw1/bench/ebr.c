@@ -0,0 +1,86 @@
+/**
+ * @file ebr.c
+ * @brief Per-operation cost of epoch-based reclamation, by thread count.
+ *
+ * Each thread repeatedly allocates a small payload and disposes of it:
+ * "free" frees it at once, which is only safe with no concurrent readers;
+ * "ebr" reads it in a critical section and passes it to deq_ebr_retire(),
+ * so it is freed later, in batches; "enter" is the critical section alone.
+ * The difference between "ebr" and "free" is the reclamation overhead.
+ *
+ * Usage:
+ *   make bench/ebr
+ *   ./bench/ebr [max-threads [ops-per-thread]]
+ *
+ * Output is CSV: variant,threads,ops,seconds,ns_per_op
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../deq.h"
+
+enum { Free, Ebr, Enter };
+
+static long ops;
+static int variant;
+static pthread_barrier_t start;
+
+static void release(Data d) { free(d); }
+
+static void *worker(void *arg) {
+    pthread_barrier_wait(&start);
+    for (long i = 0; i < ops; i++) {
+        if (variant == Enter) {
+            deq_ebr_enter();
+            deq_ebr_exit();
+            continue;
+        }
+        long *p = malloc(4 * sizeof(long));
+        p[0] = i;
+        if (variant == Free) {
+            free(p);
+            continue;
+        }
+        deq_ebr_enter();
+        __atomic_load_n(&p[0], __ATOMIC_RELAXED);
+        deq_ebr_exit();
+        deq_ebr_retire(p, release);
+    }
+    deq_ebr_flush();
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, int v, int threads) {
+    pthread_t t[threads];
+    variant = v;
+    pthread_barrier_init(&start, 0, threads + 1);
+    for (int k = 0; k < threads; k++) pthread_create(&t[k], 0, worker, 0);
+    double t0 = now();
+    pthread_barrier_wait(&start);
+    for (int k = 0; k < threads; k++) pthread_join(t[k], 0);
+    double dt = now() - t0;
+    pthread_barrier_destroy(&start);
+    printf("%s,%d,%ld,%.4f,%.2f\n", name, threads, ops * threads, dt, dt * 1e9 / (ops * threads));
+}
+
+int main(int argc, char *argv[]) {
+    int max = argc > 1 ? atoi(argv[1]) : 64;
+    ops = argc > 2 ? atol(argv[2]) : 1000000;
+
+    printf("variant,threads,ops,seconds,ns_per_op\n");
+    for (int threads = 1; threads <= max; threads *= 2) {
+        run("free", Free, threads);
+        run("ebr", Ebr, threads);
+        run("enter", Enter, threads);
+    }
+    return 0;
+}
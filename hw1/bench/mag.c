@@ -0,0 +1,73 @@
+/**
+ * @file mag.c
+ * @brief Scaling of per-thread deque churn, with and without magazines.
+ *
+ * Each thread repeatedly creates its own deque, puts elements at the
+ * tail, gets them all from the head, and deletes it, so slabs are
+ * allocated and freed as fast as the deques can use them. Slabs cached in
+ * per-thread magazines (the default) are compared against slabs from
+ * malloc, via deq_magazines(0), for 1 thread up to one per CPU.
+ *
+ * Usage:
+ *   make bench/mag
+ *   ./bench/mag [max-threads [rounds-per-thread [elements-per-round]]]
+ *
+ * Output is CSV: variant,threads,ops,seconds,mops_per_sec
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../deq.h"
+
+static long rounds, elems;
+static pthread_barrier_t start;
+
+static void *worker(void *arg) {
+    pthread_barrier_wait(&start);
+    for (long r = 0; r < rounds; r++) {
+        Deq q = deq_new();
+        for (long i = 0; i < elems; i++) deq_tail_put(q, (Data)i);
+        for (long i = 0; i < elems; i++) deq_head_get(q);
+        deq_del(q, NULL);
+    }
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, int threads) {
+    pthread_t t[threads];
+    pthread_barrier_init(&start, 0, threads + 1);
+    for (int k = 0; k < threads; k++) pthread_create(&t[k], 0, worker, 0);
+    double t0 = now();
+    pthread_barrier_wait(&start);
+    for (int k = 0; k < threads; k++) pthread_join(t[k], 0);
+    double dt = now() - t0;
+    pthread_barrier_destroy(&start);
+    long ops = 2 * rounds * elems * threads;    // puts and gets
+    printf("%s,%d,%ld,%.4f,%.2f\n", name, threads, ops, dt, ops / dt / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    int max = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    rounds = argc > 2 ? atol(argv[2]) : 2000;
+    elems = argc > 3 ? atol(argv[3]) : 1000;
+
+    printf("variant,threads,ops,seconds,mops_per_sec\n");
+    for (int threads = 1; ; threads = threads * 2 < max ? threads * 2 : max) {
+        deq_magazines(0);
+        run("malloc", threads);
+        deq_magazines(1);
+        run("magazine", threads);
+        if (threads == max) break;
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file mpmc.c
+ * @brief Fan-in/fan-out throughput, MPMC ring vs. mutex-wrapped list deque.
+ *
+ * For each thread count n, n/2 producers put elements at the tail while
+ * n/2 consumers get them from the head (at least one of each), yielding
+ * when the deque is full or empty. The lock-free MPMC ring (deq_mpmc_new)
+ * is compared against a plain deque with every call wrapped in one pthread
+ * mutex, bounded at the same capacity.
+ *
+ * Usage:
+ *   make bench/mpmc
+ *   ./bench/mpmc [max-threads [ops-per-producer [capacity]]]
+ *
+ * Output is CSV: variant,threads,ops,seconds,mops_per_sec
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../deq.h"
+
+static Deq q;
+static long ops;
+static int cap;
+static int wrapped;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+
+static int put(Data d) {
+    if (!wrapped) return deq_mpmc_tail_put(q, d);
+    pthread_mutex_lock(&mu);
+    int ok = deq_len(q) < cap;
+    if (ok) deq_tail_put(q, d);
+    pthread_mutex_unlock(&mu);
+    return ok;
+}
+
+static int get(Data *d) {
+    if (!wrapped) return deq_mpmc_head_get(q, d);
+    pthread_mutex_lock(&mu);
+    int ok = deq_len(q) > 0;
+    if (ok) *d = deq_head_get(q);
+    pthread_mutex_unlock(&mu);
+    return ok;
+}
+
+static void *producer(void *arg) {
+    for (long i = 1; i <= ops; i++)
+        while (!put((Data)i))
+            sched_yield();
+    return 0;
+}
+
+static void *consumer(void *arg) {
+    Data d;
+    for (long i = 0; i < ops; i++)
+        while (!get(&d))
+            sched_yield();
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, int pairs) {
+    pthread_t t[2 * pairs];
+    double t0 = now();
+    for (int k = 0; k < pairs; k++) {
+        pthread_create(&t[2 * k], 0, producer, 0);
+        pthread_create(&t[2 * k + 1], 0, consumer, 0);
+    }
+    for (int k = 0; k < 2 * pairs; k++) pthread_join(t[k], 0);
+    double dt = now() - t0;
+    long total = 2 * ops * pairs;           // puts and gets
+    printf("%s,%d,%ld,%.4f,%.2f\n", name, 2 * pairs, total, dt, total / dt / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    int max = argc > 1 ? atoi(argv[1]) : 64;
+    ops = argc > 2 ? atol(argv[2]) : 200000;
+    cap = argc > 3 ? atoi(argv[3]) : 1024;
+
+    printf("variant,threads,ops,seconds,mops_per_sec\n");
+    for (int pairs = 1; 2 * pairs <= max || pairs == 1; pairs *= 2) {
+        q = deq_new();
+        wrapped = 1;
+        run("mutex", pairs);
+        deq_del(q, NULL);
+
+        q = deq_mpmc_new(cap);
+        wrapped = 0;
+        run("mpmc", pairs);
+        deq_mpmc_del(q);
+    }
+    return 0;
+}
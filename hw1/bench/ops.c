@@ -0,0 +1,311 @@
+/**
+ * @file ops.c
+ * @brief Single-threaded cost of each deque operation, by deque size.
+ *
+ * For each size from 10 up to a maximum, by powers of ten, this times:
+ *   put   n puts into an empty deque
+ *   get   n gets from a deque of n
+ *   ith   n (at most OpsMax) reads of random indices
+ *   rem   removals of random present values, each put back at the far
+ *         end, to keep the size; as many as keep a run to ~OpsMax scans
+ *   map   deq_map (head) or deq_map_rev_ctx (tail) over n elements
+ *   str   deq_str of n elements, with a malloc'ing DeqStrF (head only)
+ *   fmt   deq_str_fmt of n elements (head only)
+ *   del   deq_del of a deque of n (head only)
+ * at each end where that makes sense. Each is run warmup times, untimed,
+ * then repeats times; the median and maximum of the per-run ns/op, and
+ * the median ops/sec, are reported, so results from two builds can be
+ * compared. Each run times many operations, so the maximum is that of a
+ * run's mean, not of single operations. A size of 10^8 needs several GB.
+ *
+ * With -c, hardware counters are also read, via perf_event_open, around
+ * the timed part of each run, and their totals over the repeats are
+ * reported per operation: cycles, instructions, L1d and LLC read misses,
+ * branch misses and dTLB read misses. A counter that cannot be opened
+ * (e.g., in a container, or with a high perf_event_paranoid) is left
+ * blank, with a warning; counters the PMU has to multiplex are scaled.
+ *
+ * Usage:
+ *   make bench/ops
+ *   ./bench/ops [-c] [max-size [repeats [warmup]]]
+ * or, to build and run it in one step:
+ *   make -s bench args="[-c] max-size repeats warmup"
+ *
+ * Output is CSV: op,end,size,ops,ns_per_op_median,ns_per_op_max,mops_per_sec
+ * and, with -c: cycles,instructions,l1d_misses,llc_misses,branch_misses,
+ * dtlb_misses (each per operation).
+ */
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../deq.h"
+
+#define OpsMax 100000           // most operations in a run of ith or rem
+
+enum { Head, Tail };
+
+typedef double (*Run)(long n, int e, long *ops);
+
+static unsigned long seed = 88172645463325252UL;
+
+static long rnd(long n) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed % n;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define Cache(c, r) (PERF_COUNT_HW_CACHE_##c | PERF_COUNT_HW_CACHE_OP_READ << 8 | \
+                     PERF_COUNT_HW_CACHE_RESULT_##r << 16)
+
+static struct {
+    const char *name;
+    unsigned type;
+    unsigned long config;
+    int fd;                     // -1 if unavailable, or not asked for
+    double total;               // scaled count, since perf_reset
+} ctrs[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"l1d_misses", PERF_TYPE_HW_CACHE, Cache(L1D, MISS)},
+    {"llc_misses", PERF_TYPE_HW_CACHE, Cache(LL, MISS)},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"dtlb_misses", PERF_TYPE_HW_CACHE, Cache(DTLB, MISS)},
+};
+
+#define Ctrs (int)(sizeof(ctrs) / sizeof(*ctrs))
+
+static int counting;            // -c was given
+
+static void perf_open() {
+    for (int i = 0; i < Ctrs; i++) {
+        struct perf_event_attr a;
+        memset(&a, 0, sizeof(a));
+        a.size = sizeof(a);
+        a.type = ctrs[i].type;
+        a.config = ctrs[i].config;
+        a.disabled = 1;
+        a.exclude_kernel = 1;
+        a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        ctrs[i].fd = counting ? syscall(SYS_perf_event_open, &a, 0, -1, -1, 0) : -1;
+        if (counting && ctrs[i].fd < 0)
+            fprintf(stderr, "warning: counter %s unavailable: %m\n", ctrs[i].name);
+    }
+}
+
+static void perf_reset() {
+    for (int i = 0; i < Ctrs; i++) ctrs[i].total = 0;
+}
+
+static void perf_on() {
+    for (int i = 0; i < Ctrs; i++)
+        if (ctrs[i].fd >= 0) {
+            ioctl(ctrs[i].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(ctrs[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+static void perf_off() {
+    for (int i = 0; i < Ctrs; i++)
+        if (ctrs[i].fd >= 0) ioctl(ctrs[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+    for (int i = 0; i < Ctrs; i++) {
+        unsigned long v[3];     // value, time enabled, time running
+        if (ctrs[i].fd < 0 || read(ctrs[i].fd, v, sizeof(v)) != sizeof(v)) continue;
+        ctrs[i].total += v[2] ? (double)v[0] * v[1] / v[2] : 0;
+    }
+}
+
+static void perf_print(long ops) {
+    for (int i = 0; i < Ctrs; i++)
+        if (ctrs[i].fd >= 0) printf(",%.2f", ctrs[i].total / ops);
+        else                 printf(",");
+}
+
+// The timed part of a run: start() to stop(), which returns seconds.
+static double t0;
+static int timed;               // count this run's counters
+
+static void start() {
+    if (timed) perf_on();
+    t0 = now();
+}
+
+static double stop() {
+    double dt = now() - t0;
+    if (timed) perf_off();
+    return dt;
+}
+
+// A deque of 1..n, head to tail; values are never 0, which gets reserve.
+static Deq filled(long n) {
+    Deq q = deq_new();
+    for (long i = 1; i <= n; i++) deq_tail_put(q, (Data)i);
+    return q;
+}
+
+static long sink;
+
+static void touch(Data d) { sink += (long)d; }
+static void touch_ctx(Data d, void *ctx) { sink += (long)d; }
+
+static size_t fmt(Data d, char *buf, size_t cap) {
+    return snprintf(buf, cap, "%ld", (long)d);
+}
+
+static Str show(Data d) {
+    char *s = malloc(24);
+    snprintf(s, 24, "%ld", (long)d);
+    return s;
+}
+
+static double run_put(long n, int e, long *ops) {
+    Deq q = deq_new();
+    start();
+    if (e == Head) for (long i = 1; i <= n; i++) deq_head_put(q, (Data)i);
+    else           for (long i = 1; i <= n; i++) deq_tail_put(q, (Data)i);
+    double dt = stop();
+    deq_del(q, NULL);
+    *ops = n;
+    return dt;
+}
+
+static double run_get(long n, int e, long *ops) {
+    Deq q = filled(n);
+    start();
+    if (e == Head) for (long i = 0; i < n; i++) deq_head_get(q);
+    else           for (long i = 0; i < n; i++) deq_tail_get(q);
+    double dt = stop();
+    deq_del(q, NULL);
+    *ops = n;
+    return dt;
+}
+
+static Deq shared;              // for the operations that keep the size
+
+static double run_ith(long n, int e, long *ops) {
+    long k = n < OpsMax ? n : OpsMax;
+    start();
+    if (e == Head) for (long i = 0; i < k; i++) sink += (long)deq_head_ith(shared, rnd(n));
+    else           for (long i = 0; i < k; i++) sink += (long)deq_tail_ith(shared, rnd(n));
+    *ops = k;
+    return stop();
+}
+
+static double run_rem(long n, int e, long *ops) {
+    long k = OpsMax / n;
+    if (k < 1) k = 1;
+    if (k > n) k = n;
+    start();
+    for (long i = 0; i < k; i++) {
+        Data d = (Data)(rnd(n) + 1);
+        if (e == Head) { deq_head_rem(shared, d); deq_tail_put(shared, d); }
+        else           { deq_tail_rem(shared, d); deq_head_put(shared, d); }
+    }
+    *ops = k;
+    return stop();
+}
+
+static double run_map(long n, int e, long *ops) {
+    start();
+    if (e == Head) deq_map(shared, touch);
+    else           deq_map_rev_ctx(shared, touch_ctx, 0);
+    *ops = n;
+    return stop();
+}
+
+static double run_str(long n, int e, long *ops) {
+    start();
+    Str s = deq_str(shared, show);
+    double dt = stop();
+    free(s);
+    *ops = n;
+    return dt;
+}
+
+static double run_fmt(long n, int e, long *ops) {
+    start();
+    Str s = deq_str_fmt(shared, fmt);
+    double dt = stop();
+    free(s);
+    *ops = n;
+    return dt;
+}
+
+static double run_del(long n, int e, long *ops) {
+    Deq q = filled(n);
+    start();
+    deq_del(q, NULL);
+    *ops = n;
+    return stop();
+}
+
+static struct {
+    const char *name;
+    Run run;
+    int ends;                   // 2: both ends, 1: head only
+} ops[] = {
+    {"put", run_put, 2}, {"get", run_get, 2}, {"ith", run_ith, 2}, {"rem", run_rem, 2},
+    {"map", run_map, 2}, {"str", run_str, 1}, {"fmt", run_fmt, 1}, {"del", run_del, 1},
+};
+
+static int cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && !strcmp(argv[1], "-c")) {
+        counting = 1;
+        argc--, argv++;
+    }
+    perf_open();
+    long max = argc > 1 ? atol(argv[1]) : 1000000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 21;
+    int warmup = argc > 3 ? atoi(argv[3]) : 2;
+    if (repeats < 1) repeats = 1;
+    double ns[repeats];
+
+    printf("op,end,size,ops,ns_per_op_median,ns_per_op_max,mops_per_sec");
+    for (int i = 0; counting && i < Ctrs; i++) printf(",%s", ctrs[i].name);
+    printf("\n");
+    for (long n = 10; n <= max; n *= 10) {
+        shared = filled(n);
+        for (int o = 0; o < (int)(sizeof(ops) / sizeof(*ops)); o++)
+            for (int e = Head; e < ops[o].ends; e++) {
+                long k = 0, total = 0;
+                timed = 0;
+                for (int r = 0; r < warmup; r++) ops[o].run(n, e, &k);
+                timed = counting;
+                perf_reset();
+                for (int r = 0; r < repeats; r++) {
+                    double dt = ops[o].run(n, e, &k);
+                    ns[r] = dt * 1e9 / k;
+                    total += k;
+                }
+                qsort(ns, repeats, sizeof(*ns), cmp);
+                double med = ns[repeats / 2];
+                double hi = ns[repeats - 1];
+                printf("%s,%s,%ld,%ld,%.2f,%.2f,%.2f", ops[o].name, e == Head ? "head" : "tail",
+                       n, k, med, hi, 1e3 / med);
+                if (counting) perf_print(total);
+                printf("\n");
+                fflush(stdout);
+            }
+        deq_del(shared, NULL);
+    }
+    return 0;
+}
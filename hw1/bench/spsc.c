@@ -0,0 +1,82 @@
+/**
+ * @file spsc.c
+ * @brief Producer-to-consumer throughput, SPSC ring vs. synchronized deque.
+ *
+ * One thread puts ops elements at the tail, while another gets them from
+ * the head, yielding when the deque is full or empty. The lock-free SPSC
+ * ring (deq_spsc_new) is compared against the locked deque (deq_sync_new).
+ *
+ * Usage:
+ *   make bench/spsc
+ *   ./bench/spsc [ops [capacity]]
+ *
+ * Output is CSV: variant,ops,seconds,mops_per_sec
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../deq.h"
+
+static Deq q;
+static long ops;
+static int cap;
+
+static void *spsc_producer(void *arg) {
+    for (long i = 1; i <= ops; i++)
+        while (!deq_spsc_tail_put(q, (Data)i))
+            sched_yield();
+    return 0;
+}
+
+static void *sync_producer(void *arg) {
+    for (long i = 1; i <= ops; i++) {
+        while (deq_len(q) >= cap)
+            sched_yield();
+        deq_tail_put(q, (Data)i);
+    }
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double dt) {
+    printf("%s,%ld,%.4f,%.2f\n", name, ops, dt, ops / dt / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    ops = argc > 1 ? atol(argv[1]) : 10000000;
+    cap = argc > 2 ? atoi(argv[2]) : 1024;
+    pthread_t t;
+    Data d;
+
+    printf("variant,ops,seconds,mops_per_sec\n");
+
+    q = deq_spsc_new(cap);
+    double t0 = now();
+    pthread_create(&t, 0, spsc_producer, 0);
+    for (long i = 0; i < ops; i++)
+        while (!deq_spsc_head_get(q, &d))
+            sched_yield();
+    pthread_join(t, 0);
+    report("spsc", now() - t0);
+    deq_spsc_del(q);
+
+    q = deq_sync_new();
+    t0 = now();
+    pthread_create(&t, 0, sync_producer, 0);
+    for (long i = 0; i < ops; i++)
+        while (!deq_len(q) || !deq_head_get(q))
+            sched_yield();
+    pthread_join(t, 0);
+    report("sync", now() - t0);
+    deq_del(q, NULL);
+    return 0;
+}
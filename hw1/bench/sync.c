@@ -0,0 +1,83 @@
+/**
+ * @file sync.c
+ * @brief Throughput of a shared deque under contention, by thread count.
+ *
+ * Each thread repeatedly puts an element at the tail and gets one from the
+ * head of a single shared deque. The deque from deq_sync_new(), with its
+ * spin-then-park lock, and the flat-combining one from deq_fc_new(), are
+ * compared against a plain deque with every call wrapped in a pthread
+ * mutex, which is what callers did before.
+ *
+ * Usage:
+ *   make bench/sync
+ *   ./bench/sync [max-threads [ops-per-thread]]
+ *
+ * Output is CSV: variant,threads,ops,seconds,mops_per_sec
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../deq.h"
+
+static Deq q;
+static long ops;
+static int wrapped;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start;
+
+static void *worker(void *arg) {
+    pthread_barrier_wait(&start);
+    for (long i = 0; i < ops; i += 2) {
+        if (wrapped) pthread_mutex_lock(&mu);
+        deq_tail_put(q, (Data)i);
+        if (wrapped) pthread_mutex_unlock(&mu);
+        if (wrapped) pthread_mutex_lock(&mu);
+        deq_head_get(q);
+        if (wrapped) pthread_mutex_unlock(&mu);
+    }
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, int threads) {
+    pthread_t t[threads];
+    pthread_barrier_init(&start, 0, threads + 1);
+    for (int k = 0; k < threads; k++) pthread_create(&t[k], 0, worker, 0);
+    double t0 = now();
+    pthread_barrier_wait(&start);
+    for (int k = 0; k < threads; k++) pthread_join(t[k], 0);
+    double dt = now() - t0;
+    pthread_barrier_destroy(&start);
+    printf("%s,%d,%ld,%.4f,%.2f\n", name, threads, ops * threads, dt, ops * threads / dt / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    int max = argc > 1 ? atoi(argv[1]) : 64;
+    ops = argc > 2 ? atol(argv[2]) : 1000000;
+
+    printf("variant,threads,ops,seconds,mops_per_sec\n");
+    for (int threads = 1; threads <= max; threads *= 2) {
+        q = deq_new();
+        wrapped = 1;
+        run("mutex", threads);
+        deq_del(q, NULL);
+
+        q = deq_sync_new();
+        wrapped = 0;
+        run("sync", threads);
+        deq_del(q, NULL);
+
+        q = deq_fc_new();
+        run("fc", threads);
+        deq_del(q, NULL);
+    }
+    return 0;
+}
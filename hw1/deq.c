@@ -4,6 +4,9 @@
  *
  * This file implements a double-ended queue (deque) using a doubly linked list. 
  * It provides efficient insertion, deletion, and traversal operations at both ends.
+ * List nodes are carved out of shared slabs, and recycled through a per-deque
+ * free list, rather than being malloc'd one at a time, so most puts and gets
+ * are a pointer bump.
  *
  * Features include:
  * - Insertion and deletion at both head and tail.
@@ -18,9 +21,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/uio.h>
 
 #include "deq.h"
 #include "error.h"
+#include "tpool.h"
+#include "lock.h"
+#include "ws.h"
+#include "lf.h"
+#include "mag.h"
 
 // indices and size of array of node pointers
 typedef enum {Head,Tail,Ends} End;
@@ -28,18 +40,691 @@ typedef enum {Head,Tail,Ends} End;
 typedef struct Node {
   struct Node *np[Ends];        // next/prev neighbors
   Data data;
+  unsigned ixpos;               // position in the node index, if it is in sync
+  unsigned slabofs;             // offset of the node in its slab
 } *Node;
 
+// Nodes are carved out of slabs, and freed nodes are recycled through an
+// intrusive free list (linked by np[Tail]). Splitting and splicing move
+// nodes between deques, which then share slabs, so each slab counts its
+// live nodes: carved or still to be carved, but not released. Deques in
+// different threads may release nodes of the same slab, so the count is
+// atomic, and the last release frees the slab. A deque that has never
+// exchanged nodes holds every node of its slabs, and frees them all at
+// once, from its own chain of them; one that has (it is mixed) forgets
+// that chain, and releases its nodes one by one. A mixed deque may be
+// freeing nodes that another keeps carving, as when one deque is always
+// spliced onto another, so it only recycles as many nodes as it has
+// elements (or FreeMin), and releases the rest. Mixing would keep a short
+// deque's slabs until the deque it is spliced onto is deleted, so a
+// splice moves short deques' elements one by one.
+// Slabs come from, and go back to, the calling thread's magazines (see
+// mag.c), rather than malloc.
+#define SlabMin MagMin          // bytes in a deque's first slab
+#define SlabMax MagMax          // bytes in its largest slabs
+#define SpliceMove 64           // longest source a splice moves elementwise
+#define FreeMin 64              // recycled nodes a mixed deque may always keep
+
+typedef struct Slab {
+  struct Slab *next;            // chain of the carving rep's slabs, unless mixed
+  size_t size;                  // bytes, a power of two
+  long live;                    // nodes not released, updated atomically
+  char node[];                  // nodes of the carving rep's nodesz bytes each
+} *Slab;
+
+// In a hashed deque, each node also links the other nodes holding the
+// same data, in list order, so duplicates keep head-first and tail-first
+// semantics. The table maps each distinct data value to the first and
+// last of its nodes, using open addressing with linear probing.
+typedef struct HNode {
+  struct Node n;
+  struct HNode *dup[Ends];      // next/prev nodes with equal data
+} *HNode;
+
+typedef struct {
+  HNode ht[Ends];               // head-most/tail-most nodes; 0 if vacant
+} Entry;
+
+#define HashMin 16
+
+// A Rep's mode says how operations are carried out. Other kinds of deque
+// (see ws.c, lf.c) start with the same int, so their handles can be told
+// apart.
+typedef enum {Plain,Sync,Steal,Lockfree,Combine} Mode;
+
+// A flat-combining deque has a publication slot per thread (or a few
+// threads, past FcSlots), each on its own cache line, in which a thread
+// posts a put or get for whichever thread holds the lock to carry out.
+typedef enum {SlotFree,SlotClaimed,SlotPosted,SlotDone} SlotState;
+
+#define FcSlots 64
+#define FcSpin 64               // polls of a slot between yields
+
+typedef struct {
+  _Alignas(64) SlotState state;
+  int get;                      // else put
+  End e;
+  Data d;                       // to put, or gotten
+} Slot;
+
 typedef struct {
+  Mode mode;
   Node ht[Ends];                // head/tail nodes
   int len;
+  Slab slabs;                   // slabs we carved, newest first; 0 if mixed
+  int mixed;                    // nodes have moved in or out by splice or split
+  size_t slabsz;                // bytes in the newest slab
+  size_t nodesz;                // bytes per node
+  char *next, *end;             // uncarved nodes of the newest slab
+  Node free;                    // recycled nodes
+  int nfree;                    // number of them
+  unsigned moved;               // splices and splits that took nodes from it
+  Entry *tab;                   // hash index by data; 0 if not hashed
+  unsigned tabcap;              // capacity of tab, a power of two
+  unsigned tabcnt;              // occupied entries in tab
+  Node *ix;                     // circular index of nodes, head first
+  unsigned ixcap;               // capacity of ix, a power of two
+  unsigned ixhd;                // position of the head node
+  unsigned ixgaps;              // positions in ix left by middle removals
+  unsigned *ixtree;             // Fenwick tree counting the gaps; 0 if none yet
+  int ixok;                     // ix is in sync with the list
+  Lock lock;                    // held by operations, if mode is Sync
+  int cap;                      // bound on waiting puts; 0 if none
+  Cond nonempty, nonfull;       // for waiting gets and puts, if Sync
+  Slot *slots;                  // FcSlots of them, if mode is Combine
+  int nslots;                   // slots ever used: the rest are free
+#ifdef DEQ_STATS
+  DeqStats stats;
+#endif
 } *Rep;
 
+// With DEQ_STATS defined, STAT counts into a Rep's stats; otherwise, it
+// and the stats are compiled out.
+#ifdef DEQ_STATS
+#define STAT(r,f,e,n) ((r)->stats.f[e]+=(n))
+#else
+#define STAT(r,f,e,n) ((void)0)
+#endif
+
 static Rep rep(Deq q) {
   if (!q) ERROR("zero pointer");
   return (Rep)q;
 }
 
+// Each operation on a synchronized deque runs between lock() and unlock().
+// Work-stealing and lock-free deques only support the operations that
+// route to ws.c and lf.c. Other operations on a flat-combining deque
+// just take its lock.
+static Rep lock(Deq q) {
+  Rep r=rep(q);
+  if (r->mode) {
+    if (r->mode==Steal || r->mode==Lockfree) ERROR("operation not supported by a %s deque",
+                             r->mode==Steal ? "work-stealing" : "lock-free");
+    lock_acquire(&r->lock);
+  }
+  return r;
+}
+
+// Waiters are only signalled if there are some, and what they wait for
+// holds, so an uncontended operation makes no system call.
+static void unlock(Rep r) {
+  if (!r->mode) return;
+  int g=r->len>0 && cond_signal(&r->nonempty);
+  int p=(!r->cap || r->len<r->cap) && cond_signal(&r->nonfull);
+  lock_release(&r->lock);
+  if (g) cond_wake(&r->nonempty);
+  if (p) cond_wake(&r->nonfull);
+}
+
+/**
+ * @brief Locks a deque that must be synchronized.
+ * @param q The deque.
+ * @return Its Rep, locked.
+ */
+static Rep lock_sync(Deq q) {
+  if (rep(q)->mode!=Sync) ERROR("operation needs a synchronized deque");
+  return lock(q);
+}
+
+/**
+ * @brief Waits, with the lock held, until a get or put can proceed.
+ * @param r The locked Rep.
+ * @param get Whether to wait for an element, rather than for room.
+ * @param timeout_ns The longest to wait, in nanoseconds; -1 is forever.
+ * @return 1 if it can proceed, 0 if the timeout expired first.
+ */
+static int await(Rep r, int get, long timeout_ns) {
+  Cond *c=get ? &r->nonempty : &r->nonfull;
+  long deadline=cond_deadline(timeout_ns);
+  for (;;) {
+    int ok=get ? r->len>0 : !r->cap || r->len<r->cap;
+    if (ok) return 1;
+    if (!cond_wait(c,&r->lock,deadline)) return 0;
+  }
+}
+
+/**
+ * @brief Releases nodes of a slab, freeing it if they were its last.
+ *
+ * @param s The slab.
+ * @param n The number of nodes released.
+ */
+static void slab_release(Slab s, long n) {
+  if (__atomic_sub_fetch(&s->live, n, __ATOMIC_ACQ_REL) == 0)
+    mag_free(s, s->size);
+}
+
+/**
+ * @brief Releases a node, which must not be on any deque or free list.
+ *
+ * @param n The node.
+ */
+static void node_release(Node n) {
+  slab_release((Slab) ((char *) n - n->slabofs), 1);
+}
+
+/**
+ * @brief Releases each node of a list linked by np[Tail].
+ *
+ * @param n The first node; 0 if none.
+ */
+static void nodes_release(Node n) {
+  while (n) {
+    Node next = n->np[Tail];
+    node_release(n);
+    n = next;
+  }
+}
+
+/**
+ * @brief Releases the nodes of the deque's newest slab that it has not
+ * carved, as it is done carving from it.
+ *
+ * @param r Pointer to the deque representation.
+ */
+static void slab_retire(Rep r) {
+  long rest = (r->end - r->next) / (long)r->nodesz;
+  if (rest) slab_release((Slab) (r->end - r->slabsz), rest);
+}
+
+/**
+ * @brief Marks a deque as mixed, as it is about to exchange nodes with
+ * another.
+ *
+ * Its slabs may then also hold the other deque's nodes, so it forgets
+ * them, and they are freed as their nodes are released.
+ *
+ * @param r Pointer to the deque representation.
+ */
+static void slab_mix(Rep r) {
+  r->mixed = 1;
+  r->slabs = NULL;
+}
+
+/**
+ * @brief Releases all of the deque's nodes, whether holding elements,
+ * recycled or uncarved.
+ *
+ * A deque that is not mixed holds every node of its slabs, so it just
+ * frees them; otherwise, each node is released to its slab.
+ *
+ * @param r Pointer to the deque representation.
+ */
+static void slabs_free(Rep r) {
+  if (!r->mixed) {
+    Slab curr = r->slabs;
+    while (curr) {
+      Slab next = curr->next;
+      mag_free(curr, curr->size);
+      curr = next;
+    }
+    return;
+  }
+  nodes_release(r->ht[Head]);
+  nodes_release(r->free);
+  slab_retire(r);
+}
+
+/**
+ * @brief Hands out an unused node from the deque's slab allocator.
+ *
+ * Recycled nodes are preferred; otherwise the next node of the newest slab
+ * is carved off. When that slab is exhausted, a new one twice its size (up
+ * to SlabMax bytes) is allocated, with all its nodes live, and chained onto
+ * the deque's own slabs, unless it is mixed.
+ *
+ * @param r Pointer to the deque representation.
+ * @return An uninitialized node.
+ */
+static Node node_new(Rep r) {
+  Node n = r->free;
+  if (n) {
+    r->free = n->np[Tail];
+    r->nfree--;
+    return n;
+  }
+  if (r->end - r->next < (long)r->nodesz) {
+    size_t size = r->slabsz ? r->slabsz * 2 : SlabMin;
+    if (size > SlabMax) size = SlabMax;
+    slab_retire(r);
+    Slab s = (Slab) mag_alloc(size);
+    s->next = r->slabs;
+    s->size = size;
+    s->live = (size - sizeof(*s)) / r->nodesz;
+    if (!r->mixed) r->slabs = s;
+    r->slabsz = size;
+    r->next = s->node;
+    r->end = (char *) s + size;
+  }
+  n = (Node) r->next;
+  n->slabofs = r->slabsz - (r->end - r->next);
+  r->next += r->nodesz;
+  return n;
+}
+
+/**
+ * @brief Returns a node to the deque's free list for reuse, or, if the
+ * deque is mixed and already has enough recycled nodes, to its slab.
+ *
+ * @param r Pointer to the deque representation.
+ * @param n The node to return.
+ */
+static void node_free(Rep r, Node n) {
+  if (r->mixed && r->nfree >= r->len && r->nfree >= FreeMin) {
+    node_release(n);
+    return;
+  }
+  n->np[Tail] = r->free;
+  r->free = n;
+  r->nfree++;
+}
+
+static unsigned hash(Rep r, Data d) {
+  return (unsigned)(((uintptr_t)d * 0x9E3779B97F4A7C15ull) >> 32) & (r->tabcap - 1);
+}
+
+/**
+ * @brief Finds the table slot for a data value.
+ *
+ * @param r Pointer to the (hashed) deque representation.
+ * @param d The data to look up.
+ * @return The slot holding d, or the vacant slot where d would go.
+ */
+static Entry *hash_slot(Rep r, Data d) {
+  unsigned mask = r->tabcap - 1;
+  for (unsigned k = hash(r, d); ; k = (k + 1) & mask) {
+    Entry *t = &r->tab[k];
+    if (!t->ht[Head] || t->ht[Head]->n.data == d) return t;
+  }
+}
+
+/**
+ * @brief Resizes the table to the given capacity, reinserting every entry.
+ *
+ * @param r Pointer to the (hashed) deque representation.
+ * @param cap The new capacity, a power of two.
+ */
+static void hash_resize(Rep r, unsigned cap) {
+  Entry *old = r->tab;
+  unsigned oldcap = r->tabcap;
+  r->tab = (Entry *) calloc(cap, sizeof(*r->tab));
+  if (!r->tab) ERROR("calloc() failed in hash_resize()");
+  r->tabcap = cap;
+  for (unsigned k = 0; k < oldcap; k++)
+    if (old[k].ht[Head])
+      *hash_slot(r, old[k].ht[Head]->n.data) = old[k];
+  free(old);
+}
+
+/**
+ * @brief Adds a node, just put at an end of the list, to the hash index.
+ *
+ * @param r Pointer to the (hashed) deque representation.
+ * @param e The end where the node was inserted (Head or Tail).
+ * @param n The node.
+ */
+static void hash_put(Rep r, End e, Node n) {
+  HNode h = (HNode) n;
+  if (2 * (r->tabcnt + 1) > r->tabcap) hash_resize(r, 2 * r->tabcap);
+  Entry *t = hash_slot(r, n->data);
+  h->dup[Head] = NULL;
+  h->dup[Tail] = NULL;
+  if (!t->ht[Head]) {
+    t->ht[Head] = h;
+    t->ht[Tail] = h;
+    r->tabcnt++;
+    return;
+  }
+  End o = (e == Head) ? Tail : Head;
+  h->dup[o] = t->ht[e];         // e.g., new head-most's next is old head-most
+  t->ht[e]->dup[e] = h;
+  t->ht[e] = h;
+}
+
+/**
+ * @brief Removes a node from the hash index.
+ *
+ * When the last node for a value goes, its entry is vacated, and the
+ * entries after it in the probe run are shifted back to close the gap.
+ *
+ * @param r Pointer to the (hashed) deque representation.
+ * @param n The node.
+ */
+static void hash_rem(Rep r, Node n) {
+  HNode h = (HNode) n;
+  Entry *t = hash_slot(r, n->data);
+  if (h->dup[Head]) h->dup[Head]->dup[Tail] = h->dup[Tail]; else t->ht[Head] = h->dup[Tail];
+  if (h->dup[Tail]) h->dup[Tail]->dup[Head] = h->dup[Head]; else t->ht[Tail] = h->dup[Head];
+  if (t->ht[Head]) return;
+
+  // backward-shift deletion
+  unsigned mask = r->tabcap - 1;
+  unsigned hole = t - r->tab;
+  for (unsigned k = (hole + 1) & mask; r->tab[k].ht[Head]; k = (k + 1) & mask) {
+    unsigned home = hash(r, r->tab[k].ht[Head]->n.data);
+    if (((k - home) & mask) >= ((k - hole) & mask)) {
+      r->tab[hole] = r->tab[k];
+      r->tab[k].ht[Head] = NULL;
+      hole = k;
+    }
+  }
+  r->tabcnt--;
+}
+
+/**
+ * @brief Adds a node, just linked into the middle of the list, to the hash index.
+ *
+ * Unlike hash_put(), the node's place among nodes with equal data is not
+ * known, so the list is searched outward from it, in both directions at
+ * once, for the nearest such node.
+ *
+ * @param r Pointer to the (hashed) deque representation.
+ * @param n The node.
+ */
+static void hash_link(Rep r, Node n) {
+  Entry *t = hash_slot(r, n->data);
+  if (!t->ht[Head]) {
+    hash_put(r, Head, n);
+    return;
+  }
+  HNode h = (HNode) n;
+  Node a = n->np[Head], b = n->np[Tail];
+  for (;;) {
+    HNode o = NULL;
+    End e = Head;               // side of o that h goes on
+    if (a && a->data == n->data) { o = (HNode) a; e = Tail; }
+    else if (b && b->data == n->data) { o = (HNode) b; }
+    if (o) {
+      End f = (e == Head) ? Tail : Head;
+      h->dup[f] = o;
+      h->dup[e] = o->dup[e];
+      if (o->dup[e]) o->dup[e]->dup[f] = h; else t->ht[e] = h;
+      o->dup[e] = h;
+      return;
+    }
+    if (a) a = a->np[Head];
+    if (b) b = b->np[Tail];
+  }
+}
+
+// The index is built by the first ith() and then kept in sync by end
+// operations, which only move ixhd or write one position. Positions count
+// on past the end of ix, which holds position p at p & (ixcap - 1), so
+// resizing only copies the index, and does not renumber the nodes.
+// Removing a node from the middle leaves a gap at its position (each node
+// records its own, in ixpos), and while there are gaps, a Fenwick tree
+// counting them finds the i-th node in logarithmic time. Gaps are dropped
+// as they reach an end, and the index is compacted once they outnumber
+// the nodes. An insertion in the middle fills a gap if it lands on one;
+// otherwise, and for anything else that relinks the middle of the list,
+// ixok is cleared, and the next ith() rebuilds the index. As the deque
+// drains, the index is freed, to be rebuilt at its new size.
+#define IxMin 16
+
+/**
+ * @brief Returns the capacity of an index for n nodes: the least power of
+ * two, no less than IxMin, that holds them.
+ *
+ * @param n The number of nodes.
+ * @return The capacity.
+ */
+static unsigned ix_cap(unsigned n) {
+  unsigned cap = IxMin;
+  while (cap < n) cap *= 2;
+  return cap;
+}
+
+/**
+ * @brief Moves the index to a new array of the given capacity.
+ *
+ * If the index is in sync, its positions are copied across, unless there
+ * are gaps, in which case the nodes are renumbered head first from 0,
+ * closing them.
+ *
+ * @param r Pointer to the deque representation.
+ * @param cap The new capacity, a power of two that holds the nodes.
+ */
+static void ix_resize(Rep r, unsigned cap) {
+  Node *ix = (Node *) malloc(cap * sizeof(*ix));
+  if (!ix) ERROR("malloc() failed in ix_resize()");
+  if (r->ixok && !r->ixgaps) {
+    for (unsigned p = r->ixhd; p != r->ixhd + r->len; p++)
+      ix[p & (cap - 1)] = r->ix[p & (r->ixcap - 1)];
+  } else if (r->ixok) {
+    unsigned k = 0;
+    for (unsigned p = r->ixhd; p != r->ixhd + r->len + r->ixgaps; p++) {
+      Node n = r->ix[p & (r->ixcap - 1)];
+      if (!n) continue;
+      n->ixpos = k;
+      ix[k++] = n;
+    }
+    r->ixhd = 0;
+  }
+  free(r->ix);
+  free(r->ixtree);
+  r->ix = ix;
+  r->ixcap = cap;
+  r->ixgaps = 0;
+  r->ixtree = NULL;
+}
+
+/**
+ * @brief Makes room in the index for at least n positions, counting gaps.
+ *
+ * If there is not, the index is compacted, into a larger array if need be.
+ *
+ * @param r Pointer to the deque representation.
+ * @param n The number of positions the index must hold.
+ */
+static void ix_grow(Rep r, unsigned n) {
+  if (n <= r->ixcap) return;
+  ix_resize(r, ix_cap(n - r->ixgaps));
+}
+
+/**
+ * @brief Marks the index out of sync with the list.
+ *
+ * @param r Pointer to the deque representation.
+ */
+static void ix_clear(Rep r) {
+  r->ixok = 0;
+  r->ixgaps = 0;
+  free(r->ixtree);
+  r->ixtree = NULL;
+}
+
+/**
+ * @brief Rebuilds the index from the list, head first, sized to fit.
+ *
+ * @param r Pointer to the deque representation.
+ */
+static void ix_build(Rep r) {
+  ix_clear(r);
+  unsigned cap = ix_cap(r->len);
+  if (cap != r->ixcap) ix_resize(r, cap);
+  unsigned k = 0;
+  for (Node n = r->ht[Head]; n; n = n->np[Tail]) {
+    n->ixpos = k;
+    r->ix[k++] = n;
+  }
+  r->ixhd = 0;
+  r->ixok = 1;
+}
+
+/**
+ * @brief Adds to the count of gaps at a position, in the Fenwick tree.
+ *
+ * @param r Pointer to the deque representation.
+ * @param p The position.
+ * @param d The amount to add: 1 for a new gap, or -1 for one filled or dropped.
+ */
+static void ix_tally(Rep r, unsigned p, int d) {
+  for (unsigned k = (p & (r->ixcap - 1)) + 1; k <= r->ixcap; k += k & -k)
+    r->ixtree[k] += d;
+}
+
+/**
+ * @brief Finds the node at an index, counting from the head, in an index
+ * with gaps.
+ *
+ * The Fenwick tree counts gaps by place in ix, from 0, so this first counts
+ * the places before the head's that are not gaps (all of them unused but
+ * those the index has wrapped around to), and then looks for the least
+ * place x such that places 0 to x, not counting gaps, number that many
+ * plus k + 1; if the index wraps, and k is past the end of ix, it looks
+ * again from 0.
+ *
+ * @param r Pointer to the deque representation.
+ * @param k The index, 0 <= k < len.
+ * @return The node.
+ */
+static Node ix_find(Rep r, unsigned k) {
+  unsigned hd = r->ixhd & (r->ixcap - 1);
+  unsigned before = hd;
+  for (unsigned j = hd; j; j -= j & -j)
+    before -= r->ixtree[j];
+  unsigned upto = r->ixcap - r->ixgaps - before;
+  unsigned t = (k < upto) ? before + k + 1 : k - upto + 1;
+  unsigned x = 0;
+  for (unsigned step = r->ixcap; step; step /= 2)
+    if (x + step <= r->ixcap && step - r->ixtree[x + step] < t) {
+      x += step;
+      t -= step - r->ixtree[x];
+    }
+  return r->ix[x];
+}
+
+/**
+ * @brief Looks up the node at an index, counting from the head.
+ *
+ * @param r Pointer to the deque representation, whose index is in sync.
+ * @param k The index, 0 <= k < len.
+ * @return The node.
+ */
+static Node ix_node(Rep r, unsigned k) {
+  if (r->ixgaps) return ix_find(r, k);
+  return r->ix[(r->ixhd + k) & (r->ixcap - 1)];
+}
+
+/**
+ * @brief Records a node about to be put at an end of the deque in the index.
+ *
+ * @param r Pointer to the deque representation, with len not yet incremented.
+ * @param e The end where the node is being inserted (Head or Tail).
+ * @param n The node being inserted.
+ */
+static void ix_put(Rep r, End e, Node n) {
+  ix_grow(r, r->len + r->ixgaps + 1);
+  n->ixpos = (e == Head) ? --r->ixhd : r->ixhd + r->len + r->ixgaps;
+  r->ix[n->ixpos & (r->ixcap - 1)] = n;
+}
+
+/**
+ * @brief Drops the positions of nodes taken from an end of an index with
+ * gaps, and the gaps among them or left at the new end.
+ *
+ * @param r Pointer to the deque representation, with len already decreased.
+ * @param e The end the nodes were taken from (Head or Tail).
+ * @param n The number of nodes.
+ */
+static void ix_drop(Rep r, End e, unsigned n) {
+  for (unsigned end = r->ixhd + r->len + n + r->ixgaps; n || r->ixgaps; ) {
+    unsigned p = (e == Head) ? r->ixhd : end - 1;
+    if (r->ix[p & (r->ixcap - 1)]) {
+      if (!n) break;
+      n--;
+    } else {
+      ix_tally(r, p, -1);
+      r->ixgaps--;
+    }
+    if (e == Head) r->ixhd++; else end--;
+  }
+}
+
+/**
+ * @brief Drops the positions of nodes taken from an end of the deque from
+ * the index.
+ *
+ * An index left less than a quarter full is freed, rather than copied to a
+ * smaller one, for the next ith() to rebuild at the deque's size, so a
+ * draining deque neither keeps its largest index nor pays to shrink it
+ * unless it is indexed again.
+ *
+ * @param r Pointer to the deque representation, with len already decreased.
+ * @param e The end the nodes were taken from (Head or Tail).
+ * @param n The number of nodes.
+ */
+static void ix_pop(Rep r, End e, unsigned n) {
+  if (r->ixgaps) ix_drop(r, e, n);
+  else if (r->ixok && e == Head) r->ixhd += n;
+  if (r->ixcap > IxMin && r->len + r->ixgaps < r->ixcap / 4) {
+    ix_clear(r);
+    free(r->ix);
+    r->ix = NULL;
+    r->ixcap = 0;
+  }
+}
+
+/**
+ * @brief Leaves a gap in the index where a node removed from the middle of
+ * the deque was, compacting the index once gaps outnumber nodes.
+ *
+ * @param r Pointer to the deque representation, with len already decreased.
+ * @param n The node removed.
+ */
+static void ix_gap(Rep r, Node n) {
+  if (!r->ixok) return;
+  if (!r->ixtree) {
+    r->ixtree = (unsigned *) calloc(r->ixcap + 1, sizeof(*r->ixtree));
+    if (!r->ixtree) ERROR("calloc() failed in ix_gap()");
+  }
+  r->ix[n->ixpos & (r->ixcap - 1)] = NULL;
+  ix_tally(r, n->ixpos, 1);
+  if (++r->ixgaps > (unsigned)r->len) ix_resize(r, ix_cap(2 * r->len));
+}
+
+/**
+ * @brief Records a node inserted in the middle of the deque in the index,
+ * if there is a gap just after its neighbor toward the head.
+ *
+ * Otherwise, the index is marked out of sync.
+ *
+ * @param r Pointer to the deque representation.
+ * @param a The new node's neighbor toward the head.
+ * @param n The new node.
+ */
+static void ix_insert(Rep r, Node a, Node n) {
+  if (!r->ixok) return;
+  if (r->ix[(a->ixpos + 1) & (r->ixcap - 1)]) {
+    ix_clear(r);
+    return;
+  }
+  n->ixpos = a->ixpos + 1;
+  r->ix[n->ixpos & (r->ixcap - 1)] = n;
+  ix_tally(r, n->ixpos, -1);
+  r->ixgaps--;
+}
+
 /**
  * @brief Inserts a new node with the given data at the specified end of the deque.
  *
@@ -52,18 +737,21 @@ static Rep rep(Deq q) {
  * @param d The data to be stored in the new node.
  *
  * @note If the deque representation pointer is NULL, the function returns immediately.
- * @note If memory allocation for the new node fails, an error is reported.
+ * @note If memory allocation for a new slab fails, an error is reported.
  */
 static void put(Rep r, End e, Data d) {
   // Sanity check
   if (!r) return; // Should be caught by rep(q) but just in case
 
+  STAT(r, puts, e, 1);
+
   // Create a new node
-  Node n = (Node) malloc(sizeof(*n));
-  if (!n) ERROR("malloc() failed in put()");
+  Node n = node_new(r);
   n->data = d;
   n->np[Head] = NULL;
   n->np[Tail] = NULL;
+  if (r->ixok) ix_put(r, e, n);
+  if (r->tab) hash_put(r, e, n);
 
   // If the list is empty, set the head and tail to the new node
   if (r->len == 0) {
@@ -90,6 +778,84 @@ static void put(Rep r, End e, Data d) {
   r->len++;
 }
 
+/**
+ * @brief Inserts n elements at the specified end of the deque, in order.
+ *
+ * The result is the same as n calls to put(), so at the head the last element
+ * ends up outermost. The new nodes are linked into a chain of their own, which
+ * is then attached to the deque in one step.
+ *
+ * @param r Pointer to the deque representation.
+ * @param e The end where the elements should be inserted (Head or Tail).
+ * @param src The elements to insert.
+ * @param n The number of elements.
+ */
+static void put_n(Rep r, End e, Data *src, int n) {
+  if (!r || n <= 0) return;
+  STAT(r, puts, e, n);
+  End o = (e == Head) ? Tail : Head;
+  if (r->ixok) ix_grow(r, r->len + r->ixgaps + n);
+  unsigned mask = r->ixcap - 1;
+
+  // Build the chain, innermost (first) to outermost (last)
+  Node first = NULL, last = NULL;
+  for (int k = 0; k < n; k++) {
+    Node x = node_new(r);
+    x->data = src[k];
+    x->np[e] = NULL;
+    x->np[o] = last;
+    if (last) last->np[e] = x; else first = x;
+    last = x;
+    if (r->ixok) {
+      x->ixpos = (e == Head) ? --r->ixhd : r->ixhd + r->len + r->ixgaps + k;
+      r->ix[x->ixpos & mask] = x;
+    }
+    if (r->tab) hash_put(r, e, x);
+  }
+
+  // Attach it to the deque
+  Node old = r->ht[e];
+  first->np[o] = old;
+  if (old) old->np[e] = first; else r->ht[o] = first;
+  r->ht[e] = last;
+  r->len += n;
+}
+
+/**
+ * @brief Retrieves and removes up to n elements from the specified end of the deque.
+ *
+ * The result is the same as repeated calls to get(), but the deque's end is
+ * relinked once, after the whole run of nodes has been detached.
+ *
+ * @param r Pointer to the deque representation.
+ * @param e The end to remove from (Head or Tail).
+ * @param dst Where to store the elements, in the order they were removed.
+ * @param n The maximum number of elements to remove.
+ * @return The number of elements removed.
+ */
+static int get_n(Rep r, End e, Data *dst, int n) {
+  if (!r) return 0;
+  if (n > r->len) n = r->len;
+  if (n <= 0) return 0;
+  STAT(r, gets, e, n);
+  End o = (e == Head) ? Tail : Head;
+
+  Node x = r->ht[e];
+  for (int k = 0; k < n; k++) {
+    Node next = x->np[o];
+    dst[k] = x->data;
+    if (r->tab) hash_rem(r, x);
+    node_free(r, x);
+    x = next;
+  }
+
+  r->ht[e] = x;
+  if (x) x->np[e] = NULL; else r->ht[o] = NULL;
+  r->len -= n;
+  ix_pop(r, e, n);
+  return n;
+}
+
 /**
  * ith - Retrieve the data at the i-th position from the specified end of the deque.
  * 
@@ -99,9 +865,10 @@ static void put(Rep r, End e, Data d) {
  * 
  * @return The data at the i-th position, or 0 if the deque is empty or the index is out of bounds.
  * 
- * This function traverses the deque starting from the specified end (Head or Tail) and moves
- * towards the other end until it reaches the i-th position. If the index is out of bounds,
- * an error is raised.
+ * This function looks the node up in the circular index, counting from the specified end
+ * (Head or Tail), so it takes constant time once the index is built, or logarithmic time
+ * while removals from the middle have left gaps in it. If the index is out of bounds, an
+ * error is raised.
  */
 static Data ith(Rep r, End e, int i)  { 
   // Ensure the deque representation is valid
@@ -109,20 +876,66 @@ static Data ith(Rep r, End e, int i)  {
 
   // Check if the index is within bounds
   if (i < 0 || i >= r->len) ERROR("Index out of bounds!");
+  STAT(r, iths, e, 1);
 
-  // Start traversal from the specified end (Head or Tail)
-  Node n = (e == Head) ? r->ht[Head] : r->ht[Tail];
-
-  // Traverse the deque to the i-th position
-  while (i > 0) {
-    n = (e == Head) ? n->np[Tail] : n->np[Head];
-    i--;
+  // (Re)build the index, if a middle operation invalidated it
+  if (!r->ixok) {
+    STAT(r, ith_walk, e, r->len);
+    ix_build(r);
   }
 
+  // Convert to a position counted from the head
+  unsigned k = (e == Head) ? i : r->len - 1 - i;
+  Node n = r->ixgaps ? ix_find(r, k) : r->ix[(r->ixhd + k) & (r->ixcap - 1)];
+
   // Return the data at the i-th position, or 0 if the node is null
   return (n ? n->data : 0);
 }
 
+/**
+ * @brief Unlinks a node from the deque and returns it to the allocator.
+ *
+ * Whichever of the head, tail, or middle the node is in, its neighbors are
+ * relinked around it, and the node index and hash index are updated.
+ *
+ * @param r A pointer to the deque representation.
+ * @param n The node to remove, which must be in the deque.
+ */
+static void node_unlink(Rep r, Node n) {
+  End e = Head;
+  int mid = 0;
+  if (r->len == 1) {
+    // Only one node in the list
+    r->ht[Head] = NULL;
+    r->ht[Tail] = NULL;
+  } else if (n == r->ht[Head]) {
+    // Removing the head
+    Node newHead = n->np[Tail];
+    newHead->np[Head] = NULL;
+    r->ht[Head] = newHead;
+  } else if (n == r->ht[Tail]) {
+    // Removing the tail
+    Node newTail = n->np[Head];
+    newTail->np[Tail] = NULL;
+    r->ht[Tail] = newTail;
+    e = Tail;
+  } else {
+    // Removing from the middle
+    Node prev = n->np[Head];
+    Node next = n->np[Tail];
+    prev->np[Tail] = next;
+    next->np[Head] = prev;
+    mid = 1;
+  }
+
+  if (r->tab) hash_rem(r, n);
+  r->len--;
+  if (mid) ix_gap(r, n);
+  else if (r->ixgaps || (unsigned)r->len < r->ixcap / 4) ix_pop(r, e, 1);
+  else if (r->ixok && e == Head) r->ixhd++;
+  node_free(r, n);
+}
+
 /**
  * @brief Retrieves and removes an element from the specified end of the deque.
  *
@@ -136,32 +949,15 @@ static Data ith(Rep r, End e, int i)  {
 static Data get(Rep r, End e)         { 
   if (!r || r->len ==0) {
     // empty queue or invalid rep
+    if (r) STAT(r, empty_gets, e, 1);
     return 0;
   }
+  STAT(r, gets, e, 1);
 
-  Node toRemove = (e == Head) ? r->ht[Head] : r->ht[Tail];
+  Node toRemove = r->ht[e];
   Data d = toRemove->data;
-
-  if (r->len == 1) {
-    // Only one node in the list
-    r->ht[Head] = NULL;
-    r->ht[Tail] = NULL;
-  } else if (e == Head) {
-    // Remove the head
-    Node newHead = toRemove->np[Tail];
-    newHead->np[Head] = NULL;
-    r->ht[Head] = newHead;
-  } else {
-    // Remove the tail
-    Node newTail = toRemove->np[Head];
-    newTail->np[Tail] = NULL;
-    r->ht[Tail] = newTail;
-  }
-
-  free(toRemove);
-  r->len--;
+  node_unlink(r, toRemove);
   return d;
-
 }
 
 /**
@@ -172,6 +968,9 @@ static Data get(Rep r, End e)         {
  * If the node is found and removed, the function returns the data of the removed node.
  * If the node is not found, the function returns 0.
  *
+ * In a hashed deque, the node nearest the specified end is looked up directly,
+ * in expected constant time.
+ *
  * @param r A pointer to the deque representation.
  * @param e The end from which to start the search (Head or Tail).
  * @param d The data to search for and remove.
@@ -181,36 +980,27 @@ static Data get(Rep r, End e)         {
 static Data rem(Rep r, End e, Data d) { 
   if (!r || r->len == 0) return 0;
 
+  if (r->tab) {
+    Entry *t = hash_slot(r, d);
+    if (!t->ht[Head]) {
+      STAT(r, rem_misses, e, 1);
+      return 0; // Not found
+    }
+    STAT(r, rem_hits, e, 1);
+    Node n = (Node) t->ht[e];
+    node_unlink(r, n);
+    return d;
+  }
+
   // Start from whichever end is specified
   Node n = (e == Head) ? r->ht[Head] : r->ht[Tail];
   while (n) {
+    STAT(r, rem_scan, e, 1);
     if (n->data == d) {
       // Found the node to remove
-      if (r->len == 1) {
-        // Only one node in the list
-        r->ht[Head] = NULL;
-        r->ht[Tail] = NULL;
-      } else if (n == r->ht[Head]) {
-        // Removing the head
-        Node newHead = n->np[Tail];
-        newHead->np[Head] = NULL;
-        r->ht[Head] = newHead;
-      } else if (n == r->ht[Tail]) {
-        // Removing the tail
-        Node newTail = n->np[Head];
-        newTail->np[Tail] = NULL;
-        r->ht[Tail] = newTail;
-      } else {
-        // Removing from the middle
-        Node prev = n->np[Head];
-        Node next = n->np[Tail];
-        prev->np[Tail] = next;
-        next->np[Head] = prev;
-      }
-
+      STAT(r, rem_hits, e, 1);
       Data out = n->data;
-      free(n);
-      r->len--;
+      node_unlink(r, n);
       return out;
     }
 
@@ -218,53 +1008,812 @@ static Data rem(Rep r, End e, Data d) {
     n = (e == Head) ? n->np[Tail] : n->np[Head];
   }
 
+  STAT(r, rem_misses, e, 1);
   return 0; // Not found
 }
 
+/**
+ * @brief Moves every element of one deque onto an end of another.
+ *
+ * The source's node chain is linked onto the destination as a whole, keeping
+ * its order, and both deques are mixed (see slab_mix), as the nodes stay
+ * in the source's slabs. This takes constant time, except that a hashed
+ * destination must index each adopted node. A source of at most
+ * SpliceMove elements is moved one element at a time instead, as are plain
+ * nodes, which are too small to join a hashed deque, so the source keeps
+ * its slabs, and they go when it does. The source is left empty, but
+ * still usable, with its recycled and uncarved nodes.
+ *
+ * @param r Pointer to the destination deque representation.
+ * @param e The end of the destination to splice onto (Head or Tail).
+ * @param s Pointer to the source deque representation.
+ */
+static void splice(Rep r, End e, Rep s) {
+  if (r == s) ERROR("cannot splice a deque onto itself");
+  if (s->len == 0) return;
+  s->moved++;
+  End o = (e == Head) ? Tail : Head;
+
+  if (r->nodesz > s->nodesz || s->len <= SpliceMove) {
+    while (s->len) put(r, e, get(s, o));
+    return;
+  }
+
+  slab_mix(r);
+  slab_mix(s);
+
+  // Link the source's chain on, its o end next to our e end
+  Node near = s->ht[o];
+  Node far = s->ht[e];
+  if (r->len) {
+    r->ht[e]->np[e] = near;
+    near->np[o] = r->ht[e];
+  } else {
+    r->ht[o] = near;
+  }
+  r->ht[e] = far;
+  if (r->tab)
+    for (Node n = near; n; n = n->np[e])
+      hash_put(r, e, n);
+  r->len += s->len;
+  ix_clear(r);
+
+  // Leave the source empty
+  s->ht[Head] = NULL;
+  s->ht[Tail] = NULL;
+  s->len = 0;
+  if (s->tab) {
+    memset(s->tab, 0, s->tabcap * sizeof(*s->tab));
+    s->tabcnt = 0;
+  }
+  ix_clear(s);
+}
+
+/**
+ * @brief Moves the elements from index i (counting from the head) onward
+ * into a new deque.
+ *
+ * The new deque is of the same kind (plain or hashed), and takes the
+ * existing nodes, by cutting the chain between positions i-1 and i, so
+ * both deques are mixed (see slab_mix). Finding position i takes constant
+ * time if the node index is in sync, and otherwise a walk from the nearer
+ * end; a hashed deque must also move the hash entries of the nodes it
+ * gives up.
+ *
+ * @param r Pointer to the deque representation.
+ * @param i The index of the first element to move, 0 <= i <= len.
+ * @return The new deque representation.
+ */
+static Rep split(Rep r, int i) {
+  if (i < 0 || i > r->len) ERROR("Index out of bounds!");
+  Rep t = (Rep) (r->tab ? deq_hash_new() : deq_new());
+  if (i == r->len) return t;
+  r->moved++;
+
+  slab_mix(r);
+  slab_mix(t);
+
+  // Find the first node to move
+  Node n;
+  if (r->ixok) {
+    n = ix_node(r, i);
+  } else if (i <= r->len / 2) {
+    n = r->ht[Head];
+    for (int k = 0; k < i; k++) n = n->np[Tail];
+  } else {
+    n = r->ht[Tail];
+    for (int k = r->len - 1; k > i; k--) n = n->np[Head];
+  }
+
+  // Cut the chain in front of it
+  t->ht[Head] = n;
+  t->ht[Tail] = r->ht[Tail];
+  t->len = r->len - i;
+  r->ht[Tail] = n->np[Head];
+  if (r->ht[Tail]) r->ht[Tail]->np[Tail] = NULL; else r->ht[Head] = NULL;
+  n->np[Head] = NULL;
+  r->len = i;
+  ix_pop(r, Tail, t->len);
+  if (r->tab)
+    for (; n; n = n->np[Tail]) {
+      hash_rem(r, n);
+      hash_put(t, Tail, n);
+    }
+  return t;
+}
+
+// A cursor walks away from the end it started from, and is off the
+// deque when its node is 0. It stays valid across operations that do not
+// remove its current node, but not across a splice or split that takes
+// nodes from its deque, as its node may have moved to another: using it
+// after one is an error.
+typedef struct {
+  Rep r;
+  End e;                        // end the cursor started from
+  Node n;                       // current node; 0 if off the deque
+  unsigned moved;               // r->moved when the cursor was made
+} *Iter;
+
+static Iter iter(DeqIter it) {
+  if (!it) ERROR("zero pointer");
+  return (Iter)it;
+}
+
+// Locks a cursor's deque, and checks the cursor is still valid.
+static Iter iter_lock(DeqIter it) {
+  Iter i=iter(it);
+  lock(i->r);
+  if (i->moved!=i->r->moved) ERROR("cursor used after a splice or split from its deque");
+  return i;
+}
+
+static DeqIter iter_new(Rep r, End e) {
+  Iter it=(Iter)malloc(sizeof(*it));
+  if (!it) ERROR("malloc() failed");
+  it->r=r;
+  it->e=e;
+  it->n=r->ht[e];
+  it->moved=r->moved;
+  return it;
+}
+
+static void iter_next(Iter it) {
+  if (it->n) it->n = it->n->np[(it->e == Head) ? Tail : Head];
+}
+
+/**
+ * @brief Moves a cursor back, toward the end it started from.
+ *
+ * From off the deque, it moves onto the element at the far end, so a cursor
+ * that ran off the end can back up onto the last element it visited.
+ *
+ * @param it Pointer to the cursor.
+ */
+static void iter_prev(Iter it) {
+  End o = (it->e == Head) ? Tail : Head;
+  it->n = it->n ? it->n->np[it->e] : it->r->ht[o];
+}
+
+/**
+ * @brief Removes a cursor's current element, moving the cursor to the next.
+ *
+ * @param it Pointer to the cursor.
+ * @return The removed data, or 0 if the cursor is off the deque.
+ */
+static Data iter_rem(Iter it) {
+  Node n = it->n;
+  if (!n) return 0;
+  it->n = n->np[(it->e == Head) ? Tail : Head];
+  Data d = n->data;
+  node_unlink(it->r, n);
+  return d;
+}
+
+/**
+ * @brief Inserts data just before a cursor's current element.
+ *
+ * "Before" is toward the end the cursor started from, so the new element
+ * takes the current element's index, and the cursor stays on the current
+ * element. From off the deque, the data is put at the far end.
+ *
+ * @param it Pointer to the cursor.
+ * @param d The data to insert.
+ */
+static void iter_put(Iter it, Data d) {
+  Rep r = it->r;
+  End e = it->e;
+  End o = (e == Head) ? Tail : Head;
+  Node n = it->n;
+  if (!n) { put(r, o, d); return; }
+  if (n == r->ht[e]) { put(r, e, d); return; }
+
+  Node x = node_new(r);
+  Node p = n->np[e];
+  x->data = d;
+  x->np[e] = p;
+  x->np[o] = n;
+  p->np[o] = x;
+  n->np[e] = x;
+  r->len++;
+  ix_insert(r, (e == Head) ? p : n, x);
+  if (r->tab) hash_link(r, x);
+}
+
+static int fc_id=-1;
+static __thread int fc_me=-1;   // this thread's home slot
+
+static Slot *slots_new() {
+  Slot *s=(Slot *)aligned_alloc(_Alignof(Slot),FcSlots*sizeof(*s));
+  if (!s) ERROR("aligned_alloc() failed");
+  for (int i=0; i<FcSlots; i++)
+    s[i].state=SlotFree;
+  return s;
+}
+
+/**
+ * @brief Carries out the posted requests of a flat-combining deque.
+ * @param r The Rep, locked.
+ *
+ * The slots in use are scanned until a pass finds nothing more to do, so
+ * a thread that posts while we hold the lock is served in this batch.
+ */
+static void combine(Rep r) {
+  for (int busy=1; busy; ) {
+    busy=0;
+    Slot *end=r->slots+__atomic_load_n(&r->nslots,__ATOMIC_ACQUIRE);
+    for (Slot *s=r->slots; s<end; s++) {
+      if (__atomic_load_n(&s->state,__ATOMIC_ACQUIRE)!=SlotPosted) continue;
+      if (s->get) s->d=get(r,s->e);
+      else put(r,s->e,s->d);
+      __atomic_store_n(&s->state,SlotDone,__ATOMIC_RELEASE);
+      busy=1;
+    }
+  }
+}
+
+/**
+ * @brief Carries out a put or get on a flat-combining deque.
+ * @param r The Rep.
+ * @param getting Whether to get, rather than put.
+ * @param e The end.
+ * @param d The data to put.
+ * @return The data gotten, or 0.
+ *
+ * If the lock is free, we take it and act directly. Otherwise, we post
+ * the request in a slot, and wait until it has been carried out, by
+ * the lock holder, or by us, if we get the lock first.
+ */
+static Data fc(Rep r, int getting, End e, Data d) {
+  if (lock_try(&r->lock)) {
+    if (getting) d=get(r,e);
+    else put(r,e,d);
+    combine(r);
+    unlock(r);
+    return d;
+  }
+  if (fc_me<0) fc_me=__atomic_add_fetch(&fc_id,1,__ATOMIC_RELAXED)%FcSlots;
+  Slot *s=&r->slots[fc_me];
+  for (SlotState f=SlotFree;
+       !__atomic_compare_exchange_n(&s->state,&f,SlotClaimed,0,
+                                    __ATOMIC_ACQUIRE,__ATOMIC_RELAXED);
+       f=SlotFree)
+    if (++s==r->slots+FcSlots) {
+      s=r->slots;
+      sched_yield();            // more threads than slots
+    }
+  int n=s-r->slots+1, m=__atomic_load_n(&r->nslots,__ATOMIC_RELAXED);
+  while (m<n && !__atomic_compare_exchange_n(&r->nslots,&m,n,1,
+                                             __ATOMIC_RELEASE,__ATOMIC_RELAXED));
+  s->get=getting;
+  s->e=e;
+  s->d=d;
+  __atomic_store_n(&s->state,SlotPosted,__ATOMIC_RELEASE);
+  for (int spin=0; __atomic_load_n(&s->state,__ATOMIC_ACQUIRE)!=SlotDone; )
+    if (lock_try(&r->lock)) {
+      combine(r);
+      unlock(r);
+    } else if (++spin%FcSpin==0) {
+      sched_yield();
+    }
+  d=s->d;
+  __atomic_store_n(&s->state,SlotFree,__ATOMIC_RELEASE);
+  return d;
+}
+
 extern Deq deq_new() {
   Rep r=(Rep)malloc(sizeof(*r));
   if (!r) ERROR("malloc() failed");
   r->ht[Head]=0;
   r->ht[Tail]=0;
   r->len=0;
+  r->slabs=0;
+  r->mixed=0;
+  r->slabsz=0;
+  r->nodesz=sizeof(struct Node);
+  r->next=0;
+  r->end=0;
+  r->free=0;
+  r->nfree=0;
+  r->moved=0;
+  r->tab=0;
+  r->tabcap=0;
+  r->tabcnt=0;
+  r->ix=0;
+  r->ixcap=0;
+  r->ixhd=0;
+  r->ixgaps=0;
+  r->ixtree=0;
+  r->ixok=0;
+  r->mode=Plain;
+  r->lock=(Lock)LOCK_INIT;
+  r->cap=0;
+  r->nonempty=(Cond)COND_INIT;
+  r->nonfull=(Cond)COND_INIT;
+  r->slots=0;
+  r->nslots=0;
+#ifdef DEQ_STATS
+  memset(&r->stats,0,sizeof(r->stats));
+#endif
   return r;
 }
 
-extern int deq_len(Deq q) { return rep(q)->len; }
+extern Deq deq_hash_new() {
+  Rep r=deq_new();
+  r->nodesz=sizeof(struct HNode);
+  r->tab=(Entry *)calloc(HashMin,sizeof(*r->tab));
+  if (!r->tab) ERROR("calloc() failed");
+  r->tabcap=HashMin;
+  return r;
+}
 
-extern void deq_head_put(Deq q, Data d) {        put(rep(q),Head,d); }
-extern Data deq_head_get(Deq q)         { return get(rep(q),Head);   }
-extern Data deq_head_ith(Deq q, int i)  { return ith(rep(q),Head,i); }
-extern Data deq_head_rem(Deq q, Data d) { return rem(rep(q),Head,d); }
+extern Deq deq_sync_new() {
+  Rep r=deq_new();
+  r->mode=Sync;
+  return r;
+}
 
-extern void deq_tail_put(Deq q, Data d) {        put(rep(q),Tail,d); }
-extern Data deq_tail_get(Deq q)         { return get(rep(q),Tail);   }
-extern Data deq_tail_ith(Deq q, int i)  { return ith(rep(q),Tail,i); }
-extern Data deq_tail_rem(Deq q, Data d) { return rem(rep(q),Tail,d); }
+extern Deq deq_sync_bounded_new(int cap) {
+  if (cap<1) ERROR("capacity must be positive");
+  Rep r=deq_sync_new();
+  r->cap=cap;
+  return r;
+}
 
-extern void deq_map(Deq q, DeqMapF f) {
-  for (Node n=rep(q)->ht[Head]; n; n=n->np[Tail])
+extern Deq deq_fc_new() {
+  Rep r=deq_new();
+  r->mode=Combine;
+  r->slots=slots_new();
+  return r;
+}
+
+extern Deq deq_ws_new() { return ws_new(Steal); }
+extern Deq deq_lf_new() { return lf_new(Lockfree); }
+
+extern int deq_len(Deq q) {
+  if (rep(q)->mode==Steal) return ws_len(q);
+  if (rep(q)->mode==Lockfree) return lf_len(q);
+  Rep r=lock(q); int x=r->len; unlock(r); return x;
+}
+
+extern void deq_head_put(Deq q, Data d) {
+  if (rep(q)->mode==Lockfree) { lf_put(q,Head,d); return; }
+  if (rep(q)->mode==Combine) { fc(q,0,Head,d); return; }
+  Rep r=lock(q); put(r,Head,d); unlock(r);
+}
+
+extern Data deq_head_get(Deq q) {
+  if (rep(q)->mode==Lockfree) return lf_get(q,Head);
+  if (rep(q)->mode==Combine) return fc(q,1,Head,0);
+  Rep r=lock(q); Data x=get(r,Head); unlock(r); return x;
+}
+
+extern Data deq_head_ith(Deq q, int i)  { Rep r=lock(q); Data x=ith(r,Head,i);   unlock(r); return x; }
+extern Data deq_head_rem(Deq q, Data d) { Rep r=lock(q); Data x=rem(r,Head,d);   unlock(r); return x; }
+
+extern Data deq_head_steal(Deq q) {
+  if (rep(q)->mode==Steal) return ws_steal(q);
+  return deq_head_get(q);
+}
+
+extern void deq_head_put_n(Deq q, Data *src, int n) { Rep r=lock(q);       put_n(r,Head,src,n); unlock(r);           }
+extern int  deq_head_get_n(Deq q, Data *dst, int n) { Rep r=lock(q); int x=get_n(r,Head,dst,n); unlock(r); return x; }
+
+extern void deq_tail_put(Deq q, Data d) {
+  if (rep(q)->mode==Steal) { ws_put(q,d); return; }
+  if (rep(q)->mode==Lockfree) { lf_put(q,Tail,d); return; }
+  if (rep(q)->mode==Combine) { fc(q,0,Tail,d); return; }
+  Rep r=lock(q); put(r,Tail,d); unlock(r);
+}
+
+extern Data deq_tail_get(Deq q) {
+  if (rep(q)->mode==Steal) return ws_get(q);
+  if (rep(q)->mode==Lockfree) return lf_get(q,Tail);
+  if (rep(q)->mode==Combine) return fc(q,1,Tail,0);
+  Rep r=lock(q); Data x=get(r,Tail); unlock(r); return x;
+}
+
+extern Data deq_tail_ith(Deq q, int i)  { Rep r=lock(q); Data x=ith(r,Tail,i);   unlock(r); return x; }
+extern Data deq_tail_rem(Deq q, Data d) { Rep r=lock(q); Data x=rem(r,Tail,d);   unlock(r); return x; }
+
+extern void deq_tail_put_n(Deq q, Data *src, int n) { Rep r=lock(q);       put_n(r,Tail,src,n); unlock(r);           }
+extern int  deq_tail_get_n(Deq q, Data *dst, int n) { Rep r=lock(q); int x=get_n(r,Tail,dst,n); unlock(r); return x; }
+
+extern Data deq_head_get_wait(Deq q, long timeout_ns)         { Rep r=lock_sync(q); Data x=await(r,1,timeout_ns) ? get(r,Head) : 0; unlock(r); return x; }
+extern Data deq_tail_get_wait(Deq q, long timeout_ns)         { Rep r=lock_sync(q); Data x=await(r,1,timeout_ns) ? get(r,Tail) : 0; unlock(r); return x; }
+extern int  deq_head_put_wait(Deq q, Data d, long timeout_ns) { Rep r=lock_sync(q); int x=await(r,0,timeout_ns); if (x) put(r,Head,d); unlock(r); return x; }
+extern int  deq_tail_put_wait(Deq q, Data d, long timeout_ns) { Rep r=lock_sync(q); int x=await(r,0,timeout_ns); if (x) put(r,Tail,d); unlock(r); return x; }
+
+// Splicing locks both deques, in address order, so that concurrent
+// splices in opposite directions cannot deadlock.
+static void splice_sync(Deq q, End e, Deq src) {
+  Rep r=rep(q), s=rep(src);
+  if (r==s) ERROR("cannot splice a deque onto itself");
+  Rep a=(r<s) ? r : s, b=(r<s) ? s : r;
+  lock(a);
+  lock(b);
+  splice(r,e,s);
+  unlock(b);
+  unlock(a);
+}
+
+extern void deq_splice_head(Deq q, Deq src) { splice_sync(q,Head,src); }
+extern void deq_splice_tail(Deq q, Deq src) { splice_sync(q,Tail,src); }
+
+extern Deq deq_split(Deq q, int i) {
+  Rep r=lock(q);
+  Rep t=split(r,i);
+  t->mode=r->mode;
+  t->cap=r->cap;
+  if (t->mode==Combine) t->slots=slots_new();
+  unlock(r);
+  return t;
+}
+
+extern DeqIter deq_head_iter(Deq q) { Rep r=lock(q); DeqIter it=iter_new(r,Head); unlock(r); return it; }
+extern DeqIter deq_tail_iter(Deq q) { Rep r=lock(q); DeqIter it=iter_new(r,Tail); unlock(r); return it; }
+
+extern int  deq_iter_ok(DeqIter it)          { Iter i=iter_lock(it); int x=i->n!=0;             unlock(i->r); return x; }
+extern Data deq_iter_data(DeqIter it)        { Iter i=iter_lock(it); Data x=i->n ? i->n->data : 0; unlock(i->r); return x; }
+extern void deq_iter_next(DeqIter it)        { Iter i=iter_lock(it);        iter_next(i);       unlock(i->r);           }
+extern void deq_iter_prev(DeqIter it)        { Iter i=iter_lock(it);        iter_prev(i);       unlock(i->r);           }
+extern Data deq_iter_rem(DeqIter it)         { Iter i=iter_lock(it); Data x=iter_rem(i);        unlock(i->r); return x; }
+extern void deq_iter_put(DeqIter it, Data d) { Iter i=iter_lock(it);        iter_put(i,d);      unlock(i->r);           }
+extern void deq_iter_del(DeqIter it)         { free(iter(it)); }
+
+static void map(Rep r, DeqMapF f) {
+  for (Node n=r->ht[Head]; n; n=n->np[Tail])
     f(n->data);
 }
 
+extern void deq_map(Deq q, DeqMapF f) { Rep r=lock(q); map(r,f); unlock(r); }
+
+extern void deq_map_ctx(Deq q, DeqMapCtxF f, void *ctx) {
+  Rep r=lock(q);
+  for (Node n=r->ht[Head]; n; n=n->np[Tail])
+    f(n->data,ctx);
+  unlock(r);
+}
+
+extern void deq_map_rev_ctx(Deq q, DeqMapCtxF f, void *ctx) {
+  Rep r=lock(q);
+  for (Node n=r->ht[Tail]; n; n=n->np[Head])
+    f(n->data,ctx);
+  unlock(r);
+}
+
+/**
+ * @brief Applies a function to each element, from an end, until it returns nonzero.
+ *
+ * @param r Pointer to the deque representation.
+ * @param e The end to start from (Head or Tail).
+ * @param f The function, which is passed each element and ctx.
+ * @param ctx Passed through to f.
+ * @return The index, from e, of the element f stopped at, or -1 if it never did.
+ */
+static int map_until(Rep r, End e, DeqMapUntilF f, void *ctx) {
+  End o = (e == Head) ? Tail : Head;
+  int i = 0;
+  for (Node n = r->ht[e]; n; n = n->np[o], i++)
+    if (f(n->data, ctx)) return i;
+  return -1;
+}
+
+extern int deq_map_until(Deq q, DeqMapUntilF f, void *ctx)     { Rep r=lock(q); int x=map_until(r,Head,f,ctx); unlock(r); return x; }
+extern int deq_map_rev_until(Deq q, DeqMapUntilF f, void *ctx) { Rep r=lock(q); int x=map_until(r,Tail,f,ctx); unlock(r); return x; }
+
+// deq_map_parallel() splits the deque into ParParts parts per thread,
+// so uneven callbacks still balance, and does not bother below par_min.
+#define ParParts 4
+
+static int par_min=10000;
+
+typedef struct {
+  Rep r;
+  DeqMapF f;
+  int parts;
+} Par;
+
+/**
+ * @brief Applies a map function to part k of a deque, head to tail.
+ *
+ * Part k is the k-th of par->parts nearly equal runs of elements, and its
+ * first node is found through the node index.
+ *
+ * @param arg Pointer to the parallel map's description.
+ * @param k The part.
+ */
+static void map_part(void *arg, int k) {
+  Par *p = (Par *) arg;
+  Rep r = p->r;
+  int lo = (long)r->len * k / p->parts;
+  int hi = (long)r->len * (k + 1) / p->parts;
+  Node n = ix_node(r, lo);
+  for (int i = lo; i < hi; i++, n = n->np[Tail])
+    p->f(n->data);
+}
+
+/**
+ * @brief Applies a map function to every element, using a pool of threads.
+ *
+ * @param r Pointer to the deque representation.
+ * @param f The map function, which must be safe to call concurrently.
+ * @param nthreads The most threads to use; if <= 0, one per online CPU.
+ */
+static void map_parallel(Rep r, DeqMapF f, int nthreads) {
+  if (nthreads <= 0) nthreads = tpool_cpus();
+  if (nthreads <= 1 || r->len < par_min) {
+    map(r, f);
+    return;
+  }
+  if (!r->ixok) ix_build(r);
+  Par par = {r, f, nthreads * ParParts};
+  if (par.parts > r->len) par.parts = r->len;
+  tpool_run(par.parts, nthreads, map_part, &par);
+}
+
+extern void deq_map_parallel(Deq q, DeqMapF f, int nthreads) { Rep r=lock(q); map_parallel(r,f,nthreads); unlock(r); }
+
+extern int deq_map_parallel_min(int len) {
+  int old=par_min;
+  par_min=len;
+  return old;
+}
+
+extern int deq_stats(Deq q, DeqStats *out) {
+  memset(out,0,sizeof(*out));
+#ifdef DEQ_STATS
+  if (rep(q)->mode==Steal || rep(q)->mode==Lockfree) return 0;
+  Rep r=lock(q); *out=r->stats; unlock(r);
+  return 1;
+#else
+  return 0;
+#endif
+}
+
 extern void deq_del(Deq q, DeqMapF f) {
-  if (f) deq_map(q,f);
-  Node curr=rep(q)->ht[Head];
-  while (curr) {
-    Node next=curr->np[Tail];
-    free(curr);
-    curr=next;
+  Rep r=rep(q);
+  if (r->mode==Steal) {
+    for (Data d; f && deq_len(q); )
+      if ((d=ws_get(q))) f(d);
+    ws_del(q);
+    return;
+  }
+  if (r->mode==Lockfree) {
+    for (Data d; f && lf_len(q); )
+      if ((d=lf_get(q,Head))) f(d);
+    lf_del(q);
+    return;
   }
+  if (f) map(r,f);
+  slabs_free(r);
+  free(r->ix);
+  free(r->ixtree);
+  free(r->tab);
+  free(r->slots);
   free(q);
 }
 
-extern Str deq_str(Deq q, DeqStrF f) {
-  char *s=strdup("");
-  for (Node n=rep(q)->ht[Head]; n; n=n->np[Tail]) {
-    char *d=f ? f(n->data) : n->data;
-    char *t; asprintf(&t,"%s%s%s",s,(*s ? " " : ""),d);
-    free(s); s=t;
+// deq_str() appends to an amortized-doubling buffer, rather than rebuilding
+// its result for each element.
+typedef struct {
+  char *s;
+  size_t len, cap;
+} Buf;
+
+// make room for n more bytes, and a NUL
+static void buf_room(Buf *b, size_t n) {
+  if (b->len + n + 1 > b->cap) {
+    size_t cap = b->cap ? b->cap : 64;
+    while (b->len + n + 1 > cap) cap *= 2;
+    char *t = (char *) realloc(b->s, cap);
+    if (!t) ERROR("realloc() failed in buf_room()");
+    b->s = t;
+    b->cap = cap;
+  }
+}
+
+static void buf_add(Buf *b, const char *s, size_t n) {
+  buf_room(b, n);
+  memcpy(b->s + b->len, s, n);
+  b->len += n;
+  b->s[b->len] = 0;
+}
+
+/**
+ * @brief Converts a deque to a string: its elements, head first, separated by spaces.
+ *
+ * As ever, a separator is only added once the string is nonempty, so empty
+ * elements at the head leave no trace. Without a conversion function, the
+ * elements are strings already, so a first pass sizes the result exactly;
+ * with one, the buffer grows by doubling and is trimmed at the end.
+ *
+ * @param r Pointer to the deque representation.
+ * @param f Converts an element to a malloc'd string, which is freed; or NULL.
+ * @return The malloc'd string.
+ */
+static Str str(Rep r, DeqStrF f) {
+  Buf b = {0, 0, 0};
+  if (!f) {
+    size_t n = 0;
+    for (Node x = r->ht[Head]; x; x = x->np[Tail])
+      n += strlen((char *) x->data) + 1;
+    b.cap = n + 1;
+    b.s = (char *) malloc(b.cap);
+    if (!b.s) ERROR("malloc() failed in str()");
+  }
+  buf_add(&b, "", 0);
+  for (Node x = r->ht[Head]; x; x = x->np[Tail]) {
+    char *d = f ? f(x->data) : x->data;
+    if (b.len) buf_add(&b, " ", 1);
+    buf_add(&b, d, strlen(d));
     if (f) free(d);
   }
-  return s;
+  if (f && b.cap > b.len + 1) {
+    char *t = (char *) realloc(b.s, b.len + 1);
+    if (t) b.s = t;
+  }
+  return b.s;
+}
+
+/**
+ * @brief Converts a deque to a string, like str(), formatting elements in place.
+ *
+ * Each element is formatted straight into the result's spare capacity. If it
+ * does not fit, the buffer grows to fit, and the element is formatted again.
+ *
+ * @param r Pointer to the deque representation.
+ * @param f Formats an element into a buffer, snprintf() style.
+ * @return The malloc'd string.
+ */
+static Str str_fmt(Rep r, DeqFmtF f) {
+  Buf b = {0, 0, 0};
+  buf_add(&b, "", 0);
+  for (Node x = r->ht[Head]; x; x = x->np[Tail]) {
+    size_t sep = b.len ? 1 : 0;
+    buf_room(&b, sep + 15);
+    size_t cap = b.cap - b.len - sep;
+    size_t n = f(x->data, b.s + b.len + sep, cap);
+    if (n >= cap) {
+      buf_room(&b, sep + n);
+      n = f(x->data, b.s + b.len + sep, n + 1);
+    }
+    if (sep) b.s[b.len] = ' ';
+    b.len += sep + n;
+    b.s[b.len] = 0;
+  }
+  if (b.cap > b.len + 1) {
+    char *t = (char *) realloc(b.s, b.len + 1);
+    if (t) b.s = t;
+  }
+  return b.s;
+}
+
+extern Str deq_str(Deq q, DeqStrF f)     { Rep r=lock(q); Str x=str(r,f);     unlock(r); return x; }
+extern Str deq_str_fmt(Deq q, DeqFmtF f) { Rep r=lock(q); Str x=str_fmt(r,f); unlock(r); return x; }
+
+// deq_write() streams what deq_str() would return. Strings that are already
+// elements are written in place, from an array of iovecs; converted ones
+// are copied into a fixed-size buffer, so they can be freed right away.
+// Both are flushed with writev() whenever either fills.
+#define IovMax 64
+#define OutMax 4096
+
+typedef struct {
+  int fd;
+  struct iovec iov[IovMax];
+  int n;                        // pending iovecs
+  char buf[OutMax];
+  size_t used;                  // bytes of buf referenced by pending iovecs
+  long total;                   // bytes written or pending
+  int err;                      // a write failed
+} Out;
+
+static void out_flush(Out *o) {
+  struct iovec *v = o->iov;
+  int n = o->n;
+  while (n > 0 && !o->err) {
+    ssize_t w = writev(o->fd, v, n);
+    if (w < 0) {
+      if (errno != EINTR) o->err = 1;
+      continue;
+    }
+    for (; n > 0 && (size_t)w >= v->iov_len; v++, n--)
+      w -= v->iov_len;
+    if (n > 0) {
+      v->iov_base = (char *) v->iov_base + w;
+      v->iov_len -= w;
+    }
+  }
+  o->n = 0;
+  o->used = 0;
+}
+
+// queue len bytes at s, which must stay put until flushed
+static void out_ref(Out *o, const char *s, size_t len) {
+  if (!len) return;
+  if (o->n == IovMax) out_flush(o);
+  o->iov[o->n].iov_base = (void *) s;
+  o->iov[o->n].iov_len = len;
+  o->n++;
+  o->total += len;
+}
+
+// queue a copy of len bytes at s
+static void out_copy(Out *o, const char *s, size_t len) {
+  if (!len) return;
+  if (o->n == IovMax || len > OutMax - o->used) out_flush(o);
+  if (len > OutMax) {
+    out_ref(o, s, len);
+    out_flush(o);
+    return;
+  }
+  char *p = o->buf + o->used;
+  memcpy(p, s, len);
+  o->used += len;
+  struct iovec *last = o->n ? &o->iov[o->n - 1] : 0;
+  if (last && (char *) last->iov_base + last->iov_len == p) {
+    last->iov_len += len;
+    o->total += len;
+  } else {
+    out_ref(o, p, len);
+  }
+}
+
+/**
+ * @brief Writes what deq_str() would return to a file descriptor, without building it.
+ *
+ * @param r Pointer to the deque representation.
+ * @param f Converts an element to a malloc'd string, which is freed; or NULL.
+ * @param fd The file descriptor.
+ * @return The number of bytes written, or -1 (with errno set) if a write failed.
+ */
+static long write_fd(Rep r, DeqStrF f, int fd) {
+  Out *o = (Out *) malloc(sizeof(*o));
+  if (!o) ERROR("malloc() failed in write_fd()");
+  o->fd = fd;
+  o->n = 0;
+  o->used = 0;
+  o->total = 0;
+  o->err = 0;
+  for (Node x = r->ht[Head]; x && !o->err; x = x->np[Tail]) {
+    if (f) {
+      char *d = f(x->data);
+      if (o->total) out_copy(o, " ", 1);
+      out_copy(o, d, strlen(d));
+      free(d);
+    } else {
+      char *d = x->data;
+      if (o->total) out_ref(o, " ", 1);
+      out_ref(o, d, strlen(d));
+    }
+  }
+  out_flush(o);
+  long total = o->err ? -1 : o->total;
+  free(o);
+  return total;
 }
+
+/**
+ * @brief Prints what deq_str() would return to a stream, without building it.
+ *
+ * The stream's own buffer does the batching.
+ *
+ * @param r Pointer to the deque representation.
+ * @param f Converts an element to a malloc'd string, which is freed; or NULL.
+ * @param fp The stream.
+ * @return The number of bytes printed, or -1 if the stream has an error.
+ */
+static long fprint(Rep r, DeqStrF f, FILE *fp) {
+  long total = 0;
+  for (Node x = r->ht[Head]; x; x = x->np[Tail]) {
+    char *d = f ? f(x->data) : x->data;
+    size_t len = strlen(d);
+    if (total) total += fwrite(" ", 1, 1, fp);
+    total += fwrite(d, 1, len, fp);
+    if (f) free(d);
+  }
+  return ferror(fp) ? -1 : total;
+}
+
+extern long deq_write(Deq q, DeqStrF f, int fd)    { Rep r=lock(q); long x=write_fd(r,f,fd); unlock(r); return x; }
+extern long deq_fprint(Deq q, DeqStrF f, FILE *fp) { Rep r=lock(q); long x=fprint(r,f,fp);   unlock(r); return x; }
@@ -1,33 +1,175 @@
 #ifndef DEQ_H
 #define DEQ_H
 
+#include <stdio.h>
+
 // put: append onto an end, len++
 // get: return from an end, len--
 // ith: return by 0-base index, len unchanged
 // rem: return by == comparing, len-- (iff found)
+// put_n/get_n: same as n puts/gets; get_n returns how many it got
+// splice: move all of src onto an end, in order, src emptied
+// split: move [i,len) by head index to a new deq, len = i
+//
+// In a deq from deq_sync_new, each operation holds the deq's lock, so
+// callbacks (map, str, ...) must not use the same deq. deq_del must not
+// race with other operations, and a cursor is only valid while no other
+// thread removes its current element. A deq split from a synchronized
+// deq is synchronized too, with its own lock; the two halves share only
+// atomic counts of the nodes in their slabs, so each can be used from a
+// different thread.
+//
+// A deq from deq_fc_new is synchronized too, but its puts and gets are
+// flat-combined: each thread posts its request, and whichever thread gets
+// the lock carries out every posted request, in one batch.
+//
+// A deq from deq_ws_new is lock-free, for work stealing. Only its owner
+// thread may deq_tail_put and deq_tail_get; any thread may
+// deq_head_steal, which returns 0 if the deq is empty or another thread
+// won a race. Besides those, it only supports deq_len and deq_del.
+// On other deqs, deq_head_steal is deq_head_get.
+//
+// A deq from deq_lf_new is lock-free and unbounded: any threads may put
+// and get at either end at once. Besides those, it only supports deq_len,
+// which is approximate while operations are in progress, and deq_del.
+//
+// On a deq from deq_sync_new or deq_sync_bounded_new, the _wait gets
+// wait for an element, and the _wait puts for the deq to hold fewer than
+// cap elements, for at most timeout_ns nanoseconds (-1: forever). Both
+// return 0 on timeout. Other puts ignore cap.
 
 typedef void *Deq;
 typedef void *Data;
 
 extern Deq deq_new();
+extern Deq deq_hash_new(); // rem by hash, not scan
+extern Deq deq_sync_new(); // thread-safe: each operation holds a lock
+extern Deq deq_sync_bounded_new(int cap); // _wait puts stop at cap
+extern Deq deq_fc_new();   // thread-safe: flat-combined puts and gets
+extern Deq deq_ws_new();   // work-stealing: see deq_head_steal
+extern Deq deq_lf_new();   // lock-free, at both ends
 extern int deq_len(Deq q);
 
+// Deqs carve their nodes from slabs cached in per-thread magazines, so
+// threads creating and draining deqs do not contend in malloc.
+// deq_magazines(0) sends slabs straight to malloc and free instead; it
+// returns the old setting.
+extern int deq_magazines(int on);
+
 extern void deq_head_put(Deq q, Data d);
 extern Data deq_head_get(Deq q);
 extern Data deq_head_ith(Deq q, int i);
 extern Data deq_head_rem(Deq q, Data d);
+extern Data deq_head_steal(Deq q);
+extern void deq_head_put_n(Deq q, Data *src, int n);
+extern int  deq_head_get_n(Deq q, Data *dst, int n);
 
 extern void deq_tail_put(Deq q, Data d);
 extern Data deq_tail_get(Deq q);
 extern Data deq_tail_ith(Deq q, int i);
 extern Data deq_tail_rem(Deq q, Data d);
+extern void deq_tail_put_n(Deq q, Data *src, int n);
+extern int  deq_tail_get_n(Deq q, Data *dst, int n);
+
+extern Data deq_head_get_wait(Deq q, long timeout_ns);
+extern Data deq_tail_get_wait(Deq q, long timeout_ns);
+extern int  deq_head_put_wait(Deq q, Data d, long timeout_ns);
+extern int  deq_tail_put_wait(Deq q, Data d, long timeout_ns);
+
+extern void deq_splice_head(Deq q, Deq src);
+extern void deq_splice_tail(Deq q, Deq src);
+extern Deq  deq_split(Deq q, int i);
+
+// A cursor starts at the head or tail element, and next/prev move it
+// away from/back toward that end. rem removes the current element and
+// moves to the next; put inserts before the current element (toward
+// the starting end), or at the far end when the cursor is off the deq.
+// A splice or split that moves elements out of a deq invalidates its
+// cursors, as their elements may have moved: using one is an error.
+// Splicing into a deq, or splitting it at its length, does not.
+typedef void *DeqIter;
+
+extern DeqIter deq_head_iter(Deq q);
+extern DeqIter deq_tail_iter(Deq q);
+extern int  deq_iter_ok(DeqIter it);   // on an element?
+extern Data deq_iter_data(DeqIter it); // peek
+extern void deq_iter_next(DeqIter it);
+extern void deq_iter_prev(DeqIter it);
+extern Data deq_iter_rem(DeqIter it);
+extern void deq_iter_put(DeqIter it, Data d);
+extern void deq_iter_del(DeqIter it);  // free
 
 typedef char *Str;
 typedef void (*DeqMapF)(Data d);
 typedef Str  (*DeqStrF)(Data d);
+typedef size_t (*DeqFmtF)(Data d, char *buf, size_t cap); // like snprintf
+typedef void (*DeqMapCtxF)(Data d, void *ctx);
+typedef int  (*DeqMapUntilF)(Data d, void *ctx); // nonzero stops
 
 extern void deq_map(Deq q, DeqMapF f); // foreach
+extern void deq_map_ctx(Deq q, DeqMapCtxF f, void *ctx);
+extern void deq_map_rev_ctx(Deq q, DeqMapCtxF f, void *ctx); // tail first
+extern int  deq_map_until(Deq q, DeqMapUntilF f, void *ctx); // head index of stop, or -1
+extern int  deq_map_rev_until(Deq q, DeqMapUntilF f, void *ctx); // tail index of stop, or -1
+
+// deq_map_parallel calls f once per element, from up to nthreads threads
+// (<= 0: one per CPU), and returns when all calls have. Each thread takes
+// runs of adjacent elements, head to tail, but calls for different runs
+// overlap in time, in no particular order. f must be thread-safe, and q
+// must not change meanwhile. Deqs shorter than deq_map_parallel_min(),
+// which sets the threshold and returns the old one, are mapped serially.
+extern void deq_map_parallel(Deq q, DeqMapF f, int nthreads);
+extern int  deq_map_parallel_min(int len);
+// In a library built with DEQ_STATS defined (make DEQ_STATS=1), each
+// deq counts its operations, by end (indexed head, tail), and deq_stats
+// copies the counts out and returns 1. Otherwise, or for a work-stealing
+// or lock-free deq, it zeroes them and returns 0, and counting costs
+// nothing. ith_walk counts nodes walked to rebuild the index for ith, and
+// rem_scan nodes compared by rem (0 in a hashed deq).
+typedef struct {
+  long puts[2], gets[2];        // elements put and gotten
+  long empty_gets[2];           // gets from an empty deq
+  long iths[2], ith_walk[2];
+  long rem_hits[2], rem_misses[2], rem_scan[2];
+} DeqStats;
+
+extern int  deq_stats(Deq q, DeqStats *out);
 extern void deq_del(Deq q, DeqMapF f); // free
 extern Str  deq_str(Deq q, DeqStrF f); // toString
+extern Str  deq_str_fmt(Deq q, DeqFmtF f); // no per-element malloc
+
+// write/print what deq_str would return, without building it;
+// return bytes written, or -1 on error
+extern long deq_write(Deq q, DeqStrF f, int fd);
+extern long deq_fprint(Deq q, DeqStrF f, FILE *fp);
+
+// A bounded single-producer/single-consumer deq: one thread puts at the
+// tail while another gets from the head, without locks. cap is rounded
+// up to a power of two. put returns 0 if full, get returns 0 if empty,
+// and len is a snapshot.
+extern Deq  deq_spsc_new(int cap);
+extern int  deq_spsc_tail_put(Deq q, Data d);
+extern int  deq_spsc_head_get(Deq q, Data *d);
+extern int  deq_spsc_len(Deq q);
+extern void deq_spsc_del(Deq q);
+
+// A bounded multi-producer/multi-consumer deq: any threads put at the
+// tail and get from the head, without locks, as for spsc (cap >= 2).
+extern Deq  deq_mpmc_new(int cap);
+extern int  deq_mpmc_tail_put(Deq q, Data d);
+extern int  deq_mpmc_head_get(Deq q, Data *d);
+extern int  deq_mpmc_len(Deq q);
+extern void deq_mpmc_del(Deq q);
+
+// Epoch-based reclamation, as the lock-free deqs use for their nodes.
+// A thread that may read data that another thread could get and free
+// does so between deq_ebr_enter and deq_ebr_exit (which nest); the
+// getter passes it to deq_ebr_retire(d,f), which calls f(d), in batches,
+// once every such reader has left. deq_ebr_flush reclaims what it can
+// of the calling thread's retired data, and returns how many remain.
+extern void deq_ebr_enter();
+extern void deq_ebr_exit();
+extern void deq_ebr_retire(Data d, DeqMapF f);
+extern int  deq_ebr_flush();
 
 #endif
@@ -0,0 +1,173 @@
+/**
+ * @file ebr.c
+ * @brief Epoch-based reclamation (Fraser, "Practical lock-freedom", 2004).
+ *
+ * A global epoch advances only once every thread in a critical section
+ * has seen its current value. Something retired in epoch e is unlinked,
+ * so a thread that could still reach it entered by epoch e; once the
+ * global epoch is e+2, every such thread has left, and it can be freed.
+ *
+ * Each thread has a record, on a global list that only grows; the
+ * records of exited threads are reused. A record keeps what its thread
+ * retired in three bags, by epoch modulo 3, and tries to advance the
+ * epoch, and empty the bags that have become safe, every EbrBatch
+ * retirements, or when asked to flush. Critical sections nest, so a
+ * caller can hold one across operations on a lock-free deque.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "deq.h"
+#include "ebr.h"
+#include "error.h"
+
+#define EbrBatch 64             // retirements between reclamations
+
+typedef struct {
+  void *p;
+  EbrF f;
+} Retired;
+
+typedef struct {
+  unsigned long epoch;          // when its contents were retired
+  Retired *v;
+  int n, cap;
+} Bag;
+
+typedef struct Rec {
+  unsigned long state;          // epoch<<1 | 1 in a critical section, else 0
+  int depth;                    // of nested critical sections
+  int used;                     // owned by a live thread
+  struct Rec *next;             // on the global list
+  Bag bags[3];
+  int count;                    // retirements since the last reclamation
+} Rec;
+
+static unsigned long epoch;
+static Rec *recs;
+static pthread_key_t key;
+static pthread_once_t once=PTHREAD_ONCE_INIT;
+static __thread Rec *me;
+
+static void bag_free(Bag *b) {
+  for (int i=0; i<b->n; i++)
+    b->v[i].f(b->v[i].p);
+  b->n=0;
+}
+
+// A thread's record is released when it exits; its bags stay full,
+// for the next owner to empty.
+static void release(void *v) {
+  Rec *r=(Rec *)v;
+  __atomic_store_n(&r->state,0,__ATOMIC_RELEASE);
+  __atomic_store_n(&r->used,0,__ATOMIC_RELEASE);
+}
+
+static void init() {
+  if (pthread_key_create(&key,release)) ERROR("pthread_key_create() failed");
+}
+
+/**
+ * @brief Finds the calling thread's record, adopting or adding one.
+ * @return The record.
+ */
+static Rec *rec() {
+  if (me) return me;
+  pthread_once(&once,init);
+  Rec *r;
+  for (r=__atomic_load_n(&recs,__ATOMIC_ACQUIRE); r; r=r->next) {
+    int free=0;
+    if (__atomic_compare_exchange_n(&r->used,&free,1,0,
+                                    __ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+      break;
+  }
+  if (!r) {
+    r=(Rec *)calloc(1,sizeof(*r));
+    if (!r) ERROR("calloc() failed");
+    r->used=1;
+    r->next=__atomic_load_n(&recs,__ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&recs,&r->next,r,1,
+                                        __ATOMIC_RELEASE,__ATOMIC_RELAXED));
+  }
+  pthread_setspecific(key,r);
+  return me=r;
+}
+
+/**
+ * @brief Advances the global epoch, if every thread in a critical
+ * section has seen it.
+ * @return The global epoch, advanced or not.
+ */
+static unsigned long advance() {
+  unsigned long e=__atomic_load_n(&epoch,__ATOMIC_SEQ_CST);
+  for (Rec *r=__atomic_load_n(&recs,__ATOMIC_ACQUIRE); r; r=r->next) {
+    unsigned long s=__atomic_load_n(&r->state,__ATOMIC_SEQ_CST);
+    if ((s & 1) && s>>1 != e) return e;
+  }
+  if (__atomic_compare_exchange_n(&epoch,&e,e+1,0,
+                                  __ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST))
+    e++;
+  return e;
+}
+
+/**
+ * @brief Tries to advance the epoch, and empties the bags that are safe.
+ * @param r The calling thread's record.
+ * @return How many retirements are still pending in its bags.
+ */
+static int reclaim(Rec *r) {
+  unsigned long e=advance();
+  int n=0;
+  for (int i=0; i<3; i++) {
+    if (r->bags[i].epoch+2<=e)
+      bag_free(&r->bags[i]);
+    n+=r->bags[i].n;
+  }
+  return n;
+}
+
+extern void ebr_enter() {
+  Rec *r=rec();
+  if (r->depth++) return;
+  unsigned long e=__atomic_load_n(&epoch,__ATOMIC_SEQ_CST);
+  // a full barrier: no shared read may move above this
+  __atomic_exchange_n(&r->state,e<<1 | 1,__ATOMIC_SEQ_CST);
+}
+
+extern void ebr_exit() {
+  if (--me->depth) return;
+  __atomic_store_n(&me->state,0,__ATOMIC_RELEASE);
+}
+
+extern void ebr_retire(void *p, EbrF f) {
+  Rec *r=rec();
+  unsigned long e=__atomic_load_n(&epoch,__ATOMIC_SEQ_CST);
+  Bag *b=&r->bags[e%3];
+  if (b->epoch!=e) {            // from epoch e-3 or before
+    bag_free(b);
+    b->epoch=e;
+  }
+  if (b->n==b->cap) {
+    b->cap=b->cap ? 2*b->cap : EbrBatch;
+    b->v=(Retired *)realloc(b->v,b->cap*sizeof(*b->v));
+    if (!b->v) ERROR("realloc() failed");
+  }
+  b->v[b->n++]=(Retired){p,f};
+  if (++r->count<EbrBatch) return;
+  r->count=0;
+  reclaim(r);
+}
+
+extern int ebr_flush() {
+  Rec *r=rec();
+  int n=0;
+  for (int i=0; i<3; i++)       // an epoch each, if no one holds them back
+    n=reclaim(r);
+  return n;
+}
+
+extern void deq_ebr_enter()                   {        ebr_enter();     }
+extern void deq_ebr_exit()                    {        ebr_exit();      }
+extern void deq_ebr_retire(Data d, DeqMapF f) {        ebr_retire(d,f); }
+extern int  deq_ebr_flush()                   { return ebr_flush();     }
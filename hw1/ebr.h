@@ -0,0 +1,20 @@
+#ifndef EBR_H
+#define EBR_H
+
+// Epoch-based reclamation, for lock-free structures whose readers may
+// still hold a pointer to what a writer has just unlinked. A thread
+// reads shared nodes only between ebr_enter() and ebr_exit(); whatever
+// is unlinked is passed to ebr_retire(p,f), which calls f(p) once every
+// thread that was inside a critical section at the time has left it.
+// Critical sections nest, and should be short; f must not retire.
+// ebr_flush tries to reclaim what the calling thread retired, and
+// returns how many are still waiting. deq.h exposes these as deq_ebr_*.
+
+typedef void (*EbrF)(void *p);
+
+extern void ebr_enter();
+extern void ebr_exit();
+extern void ebr_retire(void *p, EbrF f);
+extern int  ebr_flush();
+
+#endif
@@ -0,0 +1,203 @@
+/**
+ * @file lf.c
+ * @brief A lock-free, unbounded deque over doubly linked nodes.
+ *
+ * This is Maged Michael's "CAS-Based Lock-Free Algorithm for Shared
+ * Deques" (Euro-Par 2003). The whole state is one word, the anchor: the
+ * head and tail nodes, and a status that is either stable, or says that
+ * a node was just put at one end, but its neighbour does not yet link
+ * back to it. Every operation is one CAS of the anchor; an operation
+ * that finds the anchor unstable first completes the put in progress,
+ * by linking the neighbour, and marking the anchor stable.
+ *
+ * To fit the anchor in a word that a CAS can swap, nodes are named by
+ * 31-bit indices into a process-wide arena, rather than by pointers. A
+ * gotten node may still be read by an operation that loaded the anchor
+ * before it changed, so it is retired through ebr.c, and only then
+ * pushed onto the arena's free stack. That also means an index cannot
+ * come back, and make a stale anchor look current, while any operation
+ * could hold it.
+ */
+
+#include <stdlib.h>
+
+#include "lf.h"
+#include "ebr.h"
+#include "error.h"
+
+typedef enum {Head,Tail,Ends} End;
+typedef enum {Stable,PushHead,PushTail} Status;
+
+typedef struct {
+  Data data;
+  unsigned np[Ends];            // neighbours' indices; 0 if none
+} Node;
+
+// An anchor is: head index <<33 | tail index <<2 | status.
+typedef unsigned long Anchor;
+
+#define IxBits 31
+#define IxMask ((1UL<<IxBits)-1)
+
+static unsigned end(Anchor a, End e) { return e==Head ? a>>33 : (a>>2) & IxMask; }
+static Status status(Anchor a) { return a & 3; }
+static Anchor anchor(unsigned h, unsigned t, Status s) { return (Anchor)h<<33 | (Anchor)t<<2 | s; }
+
+typedef struct {
+  int mode;                     // as in a Rep
+  Anchor anchor;
+  long len;                     // approximate while operations race
+} *Lf;
+
+static Lf lf(Deq q) {
+  if (!q) ERROR("zero pointer");
+  return (Lf)q;
+}
+
+// The arena: chunks of nodes, allocated as indices reach them, and a
+// stack of free indices, linked by np[Tail]. Index 0 is never used.
+
+#define ChunkBits 16
+
+static Node *chunks[1<<(IxBits-ChunkBits)];
+static unsigned fresh=1;        // next index never used
+static unsigned top;            // top of the free stack
+
+static Node *node(unsigned i) {
+  Node *c=__atomic_load_n(&chunks[i>>ChunkBits],__ATOMIC_ACQUIRE);
+  return &c[i & ((1<<ChunkBits)-1)];
+}
+
+static unsigned nb(unsigned i, End e) { return __atomic_load_n(&node(i)->np[e],__ATOMIC_ACQUIRE); }
+
+// Called in a critical section, so no index we see on the stack can be
+// popped, retired and pushed again before our CAS.
+static unsigned node_new(Data d) {
+  unsigned i=__atomic_load_n(&top,__ATOMIC_ACQUIRE);
+  while (i && !__atomic_compare_exchange_n(&top,&i,nb(i,Tail),1,
+                                           __ATOMIC_ACQUIRE,__ATOMIC_ACQUIRE));
+  if (!i) {
+    i=__atomic_fetch_add(&fresh,1,__ATOMIC_RELAXED);
+    if (i>IxMask) ERROR("too many lock-free deque nodes");
+    Node **c=&chunks[i>>ChunkBits];
+    if (!__atomic_load_n(c,__ATOMIC_ACQUIRE)) {
+      Node *n=(Node *)malloc(sizeof(Node)<<ChunkBits), *none=0;
+      if (!n) ERROR("malloc() failed");
+      if (!__atomic_compare_exchange_n(c,&none,n,0,
+                                       __ATOMIC_RELEASE,__ATOMIC_ACQUIRE))
+        free(n);
+    }
+  }
+  Node *n=node(i);
+  n->data=d;
+  __atomic_store_n(&n->np[Head],0,__ATOMIC_RELAXED);
+  __atomic_store_n(&n->np[Tail],0,__ATOMIC_RELAXED);
+  return i;
+}
+
+// The EbrF for a gotten node; p is its index, not a pointer.
+static void node_free(void *p) {
+  unsigned i=(unsigned)(unsigned long)p;
+  Node *n=node(i);
+  unsigned t=__atomic_load_n(&top,__ATOMIC_RELAXED);
+  do __atomic_store_n(&n->np[Tail],t,__ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&top,&t,i,1,
+                                      __ATOMIC_RELEASE,__ATOMIC_RELAXED));
+}
+
+extern Deq lf_new(int mode) {
+  Lf q=(Lf)malloc(sizeof(*q));
+  if (!q) ERROR("malloc() failed");
+  q->mode=mode;
+  q->anchor=anchor(0,0,Stable);
+  q->len=0;
+  return q;
+}
+
+static Anchor load(Lf q) { return __atomic_load_n(&q->anchor,__ATOMIC_SEQ_CST); }
+
+static int cas(Lf q, Anchor a, Anchor b) {
+  return __atomic_compare_exchange_n(&q->anchor,&a,b,0,
+                                     __ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Completes the put that made an anchor unstable.
+ * @param q The deque.
+ * @param a The anchor, as loaded; nothing is done if it has changed.
+ */
+static void stabilize(Lf q, Anchor a) {
+  End e=status(a)==PushHead ? Head : Tail, o=!e;
+  unsigned n=end(a,e);          // the new node
+  unsigned prev=nb(n,o);        // its neighbour, which must link to it
+  if (load(q)!=a) return;
+  unsigned next=nb(prev,e);
+  if (next!=n) {
+    if (load(q)!=a) return;
+    if (!__atomic_compare_exchange_n(&node(prev)->np[e],&next,n,0,
+                                     __ATOMIC_RELEASE,__ATOMIC_RELAXED))
+      return;
+  }
+  cas(q,a,a & ~3UL);
+}
+
+extern void lf_put(Deq d, int e, Data x) {
+  Lf q=lf(d);
+  End o=!e;
+  ebr_enter();
+  unsigned n=node_new(x);
+  for (;;) {
+    Anchor a=load(q);
+    if (!end(a,e)) {
+      if (cas(q,a,anchor(n,n,Stable))) break;
+    } else if (status(a)==Stable) {
+      __atomic_store_n(&node(n)->np[o],end(a,e),__ATOMIC_RELAXED);
+      Anchor b=e==Head ? anchor(n,end(a,Tail),PushHead)
+                       : anchor(end(a,Head),n,PushTail);
+      if (cas(q,a,b)) { stabilize(q,b); break; }
+    } else {
+      stabilize(q,a);
+    }
+  }
+  ebr_exit();
+  __atomic_fetch_add(&q->len,1,__ATOMIC_RELAXED);
+}
+
+extern Data lf_get(Deq d, int e) {
+  Lf q=lf(d);
+  End o=!e;
+  ebr_enter();
+  Anchor a;
+  for (;;) {
+    a=load(q);
+    unsigned n=end(a,e);
+    if (!n) { ebr_exit(); return 0; }
+    if (n==end(a,o)) {
+      if (cas(q,a,anchor(0,0,Stable))) break;
+    } else if (status(a)==Stable) {
+      unsigned prev=nb(n,o);
+      Anchor b=e==Head ? anchor(prev,end(a,Tail),Stable)
+                       : anchor(end(a,Head),prev,Stable);
+      if (cas(q,a,b)) break;
+    } else {
+      stabilize(q,a);
+    }
+  }
+  unsigned n=end(a,e);
+  Data x=node(n)->data;
+  ebr_retire((void *)(unsigned long)n,node_free);
+  ebr_exit();
+  __atomic_fetch_sub(&q->len,1,__ATOMIC_RELAXED);
+  return x;
+}
+
+extern int lf_len(Deq q) {
+  long n=__atomic_load_n(&lf(q)->len,__ATOMIC_RELAXED);
+  return n>0 ? n : 0;
+}
+
+extern void lf_del(Deq q) {
+  while (end(load(lf(q)),Head))
+    lf_get(q,Head);
+  free(q);
+}
@@ -0,0 +1,17 @@
+#ifndef LF_H
+#define LF_H
+
+#include "deq.h"
+
+// The lock-free, unbounded deque behind deq_lf_new(). Like a Rep, it
+// starts with an int mode, which deq.c uses to route deq_head_put,
+// deq_head_get, deq_tail_put, deq_tail_get, deq_len and deq_del here.
+// An end e is 0 for the head, and 1 for the tail, as in deq.c.
+
+extern Deq  lf_new(int mode);
+extern void lf_put(Deq q, int e, Data d);
+extern Data lf_get(Deq q, int e);
+extern int  lf_len(Deq q);
+extern void lf_del(Deq q);
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file lock.c
+ * @brief The contended paths of the spin-then-park lock.
+ *
+ * This is the three-state futex mutex from Drepper's "Futexes Are Tricky",
+ * preceded by a bounded spin. The uncontended paths are inline, in lock.h.
+ * A Cond is a futex sequence number, as in the same paper's condvars.
+ */
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lock.h"
+
+#define LockSpin 100            // attempts before parking
+
+static void relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static void futex(void *addr, int op, int val) {
+  syscall(SYS_futex, addr, op, val, 0, 0, 0);
+}
+
+static long now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+extern void lock_slow(Lock *l) {
+  for (int i = 0; i < LockSpin; i++) {
+    relax();
+    int c = 0;
+    if (__atomic_load_n(&l->state, __ATOMIC_RELAXED) == 0 &&
+        __atomic_compare_exchange_n(&l->state, &c, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return;
+  }
+  // Mark the lock as having waiters, and sleep until it is released
+  while (__atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE) != 0)
+    futex(&l->state, FUTEX_WAIT_PRIVATE, 2);
+}
+
+extern void lock_wake(Lock *l) {
+  futex(&l->state, FUTEX_WAKE_PRIVATE, 1);
+}
+
+extern long cond_deadline(long timeout_ns) {
+  return timeout_ns < 0 ? -1 : now() + timeout_ns;
+}
+
+// Releases l, sleeps until signalled (or spuriously woken) or the
+// deadline passes, and reacquires l. Returns 0 iff the deadline passed
+// before it would have slept.
+extern int cond_wait(Cond *c, Lock *l, long deadline) {
+  struct timespec ts, *tp = 0;
+  if (deadline >= 0) {
+    long left = deadline - now();
+    if (left <= 0)
+      return 0;
+    ts.tv_sec = left / 1000000000L;
+    ts.tv_nsec = left % 1000000000L;
+    tp = &ts;
+  }
+  unsigned seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+  c->waiters++;
+  lock_release(l);
+  syscall(SYS_futex, &c->seq, FUTEX_WAIT_PRIVATE, seq, tp, 0, 0);
+  lock_acquire(l);
+  c->waiters--;
+  return 1;
+}
+
+extern void cond_wake(Cond *c) {
+  futex(&c->seq, FUTEX_WAKE_PRIVATE, 1);
+}
@@ -0,0 +1,63 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+// A spin-then-park mutual-exclusion lock, for short critical sections.
+// An acquirer first spins for a while, hoping the holder is about to
+// release it, and only then sleeps on a futex. A release only makes a
+// system call if some acquirer might be asleep.
+
+typedef struct {
+  int state;                    // 0: free, 1: held, 2: held, maybe waiters
+} Lock;
+
+#define LOCK_INIT {0}
+
+extern void lock_slow(Lock *l);
+extern void lock_wake(Lock *l);
+
+static inline void lock_acquire(Lock *l) {
+  int c = 0;
+  if (!__atomic_compare_exchange_n(&l->state, &c, 1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    lock_slow(l);
+}
+
+static inline int lock_try(Lock *l) {
+  int c = 0;
+  return __atomic_load_n(&l->state, __ATOMIC_RELAXED) == 0 &&
+         __atomic_compare_exchange_n(&l->state, &c, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void lock_release(Lock *l) {
+  if (__atomic_exchange_n(&l->state, 0, __ATOMIC_RELEASE) == 2)
+    lock_wake(l);
+}
+
+// A condition that holders of a Lock can wait for. A waiter counts
+// itself in waiters, so a signaller can skip the system call when there
+// are none; seq changes on each signal, so none is lost between a
+// waiter's release of the lock and its sleep.
+
+typedef struct {
+  unsigned seq;                 // futex word, bumped by each signal
+  int waiters;                  // sleepers, or about to be; under the lock
+} Cond;
+
+#define COND_INIT {0,0}
+
+// Deadlines are absolute CLOCK_MONOTONIC nanoseconds; -1 is never.
+extern long cond_deadline(long timeout_ns);
+extern int  cond_wait(Cond *c, Lock *l, long deadline);
+extern void cond_wake(Cond *c);
+
+// Called with the lock held; if this returns 1, call cond_wake after
+// releasing it.
+static inline int cond_signal(Cond *c) {
+  if (!c->waiters)
+    return 0;
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+#endif
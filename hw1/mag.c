@@ -0,0 +1,177 @@
+/**
+ * @file mag.c
+ * @brief Per-thread magazines of memory blocks, with a global depot.
+ *
+ * This is the magazine layer of Bonwick and Adams, "Magazines and Vmem"
+ * (USENIX 2001). For each block size, a thread has a loaded magazine and
+ * a previous one. It allocates from, and frees to, the loaded one; when
+ * that is empty (or full), it swaps in the previous one, if that is full
+ * (or empty), and only otherwise goes to the depot, where it trades a
+ * whole magazine under the depot's lock. So a thread takes a lock at most
+ * once per magazine's worth of operations, rather than malloc's arena lock
+ * on every one.
+ *
+ * Magazines of larger blocks hold fewer of them, so a thread caches at
+ * most a few MagBytes of each size. The depot keeps at most DepotMax
+ * loaded magazines of each size; past that, blocks go back to free().
+ * When a thread exits, its magazines go to the depot.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "deq.h"
+#include "mag.h"
+#include "error.h"
+
+#define Classes 9               // sizes MagMin<<k, for k in [0,Classes)
+#define MagCap 16               // most blocks in a magazine
+#define MagBytes (1<<18)        // most bytes in a magazine of big blocks
+#define DepotMax 8              // loaded magazines in the depot, per size
+
+typedef struct Mag {
+  struct Mag *next;             // in the depot
+  int n;                        // blocks held
+  void *blk[MagCap];
+} *Mag;
+
+typedef struct {
+  Mag loaded, prev;
+} Cache;
+
+typedef struct {
+  pthread_mutex_t mu;
+  Mag full, empty;              // loaded magazines need not be full
+  int nfull;
+} Depot;
+
+static Depot depots[Classes];
+static __thread Cache caches[Classes];
+static __thread int registered;
+static pthread_key_t key;
+static pthread_once_t once=PTHREAD_ONCE_INIT;
+static int enabled=1;
+
+static int cls(size_t size) {
+  if (size<MagMin || size>MagMax || (size & (size-1)))
+    ERROR("bad magazine block size %zu",size);
+  return __builtin_ctzl(size/MagMin);
+}
+
+static int cap(int k) {
+  int n=MagBytes/(MagMin<<k);
+  return n<1 ? 1 : n>MagCap ? MagCap : n;
+}
+
+static Mag mag_new() {
+  Mag m=(Mag)malloc(sizeof(*m));
+  if (!m) ERROR("malloc() failed");
+  m->n=0;
+  return m;
+}
+
+static void mag_empty(Mag m) {
+  while (m->n)
+    free(m->blk[--m->n]);
+}
+
+/**
+ * @brief Gives a magazine to the depot, keeping only its empty shell if
+ * the depot already holds enough blocks.
+ * @param d The depot, locked.
+ * @param m The magazine, or 0.
+ */
+static void deposit(Depot *d, Mag m) {
+  if (!m) return;
+  if (m->n && d->nfull==DepotMax) mag_empty(m);
+  if (m->n) {
+    m->next=d->full;
+    d->full=m;
+    d->nfull++;
+  } else {
+    m->next=d->empty;
+    d->empty=m;
+  }
+}
+
+static void flush(void *v) {
+  for (int k=0; k<Classes; k++) {
+    Depot *d=&depots[k];
+    pthread_mutex_lock(&d->mu);
+    deposit(d,caches[k].loaded);
+    deposit(d,caches[k].prev);
+    pthread_mutex_unlock(&d->mu);
+    caches[k].loaded=caches[k].prev=0;
+  }
+}
+
+static void init() {
+  for (int k=0; k<Classes; k++)
+    pthread_mutex_init(&depots[k].mu,0);
+  if (pthread_key_create(&key,flush)) ERROR("pthread_key_create() failed");
+}
+
+// The key's value only matters for triggering flush at thread exit.
+static void reg() {
+  pthread_once(&once,init);
+  pthread_setspecific(key,caches);
+  registered=1;
+}
+
+extern void *mag_alloc(size_t size) {
+  int k=cls(size);
+  if (!__atomic_load_n(&enabled,__ATOMIC_RELAXED)) goto fresh;
+  Cache *c=&caches[k];
+  if (c->loaded && c->loaded->n)
+    return c->loaded->blk[--c->loaded->n];
+  if (c->prev && c->prev->n) {
+    Mag m=c->loaded; c->loaded=c->prev; c->prev=m;
+    return c->loaded->blk[--c->loaded->n];
+  }
+  if (!registered) reg();
+  Depot *d=&depots[k];
+  pthread_mutex_lock(&d->mu);
+  Mag m=d->full;
+  if (m) {
+    d->full=m->next;
+    d->nfull--;
+    deposit(d,c->prev);         // empty, or absent
+    c->prev=c->loaded;
+    c->loaded=m;
+  }
+  pthread_mutex_unlock(&d->mu);
+  if (m) return m->blk[--m->n];
+fresh:;
+  void *p=malloc(size);
+  if (!p) ERROR("malloc() failed");
+  return p;
+}
+
+extern void mag_free(void *p, size_t size) {
+  int k=cls(size), n=cap(k);
+  if (!__atomic_load_n(&enabled,__ATOMIC_RELAXED)) { free(p); return; }
+  Cache *c=&caches[k];
+  if (c->loaded && c->loaded->n<n) {
+    c->loaded->blk[c->loaded->n++]=p;
+    return;
+  }
+  if (c->prev && !c->prev->n) {
+    Mag m=c->loaded; c->loaded=c->prev; c->prev=m;
+    c->loaded->blk[c->loaded->n++]=p;
+    return;
+  }
+  if (!registered) reg();
+  Depot *d=&depots[k];
+  pthread_mutex_lock(&d->mu);
+  deposit(d,c->prev);           // full, or absent
+  c->prev=c->loaded;
+  Mag m=d->empty;
+  if (m) d->empty=m->next;
+  pthread_mutex_unlock(&d->mu);
+  c->loaded=m ? m : mag_new();
+  c->loaded->blk[c->loaded->n++]=p;
+}
+
+extern int deq_magazines(int on) {
+  return __atomic_exchange_n(&enabled,on,__ATOMIC_RELAXED);
+}
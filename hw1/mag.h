@@ -0,0 +1,18 @@
+#ifndef MAG_H
+#define MAG_H
+
+#include <stddef.h>
+
+// A cache of memory blocks, for deque slabs, in power-of-two sizes from
+// MagMin to MagMax bytes. Each thread keeps magazines (small stacks) of
+// blocks of each size, so most allocations and frees touch no shared
+// state; a global depot exchanges full and empty magazines between
+// threads, and malloc is only called when the depot has none.
+
+#define MagMin (1<<10)
+#define MagMax (1<<18)
+
+extern void *mag_alloc(size_t size);
+extern void  mag_free(void *p, size_t size);
+
+#endif
@@ -0,0 +1,111 @@
+/**
+ * @file mpmc.c
+ * @brief A lock-free, bounded, multi-producer/multi-consumer deque.
+ *
+ * Any thread puts at the tail, and any thread gets from the head, of a
+ * preallocated ring of power-of-two size. This is Dmitry Vyukov's bounded
+ * MPMC queue: each cell carries a sequence number saying whose turn it is.
+ * A cell at position pos is free for the put of pos when its sequence is
+ * pos, and full for the get of pos when it is pos+1; the get then sets it
+ * to pos+size, for the put one lap later. Producers and consumers only
+ * contend, by CAS, on their own end's counter, which has its own cache line.
+ */
+
+#include <stdlib.h>
+
+#include "deq.h"
+#include "error.h"
+
+#define Line 64                 // cache-line size
+
+typedef struct {
+  unsigned long seq;
+  Data data;
+} Cell;
+
+typedef struct {
+  _Alignas(Line) unsigned long tail; // next position to put
+  _Alignas(Line) unsigned long head; // next position to get
+  _Alignas(Line) unsigned long mask; // ring size - 1
+  Cell *ring;
+} *Mpmc;
+
+static Mpmc mpmc(Deq q) {
+  if (!q) ERROR("zero pointer");
+  return (Mpmc)q;
+}
+
+extern Deq deq_mpmc_new(int cap) {
+  if (cap < 2) ERROR("capacity must be at least 2");
+  unsigned long n=1;
+  while (n < (unsigned long)cap) n*=2;
+  Mpmc m=(Mpmc)aligned_alloc(Line,sizeof(*m));
+  Cell *ring=(Cell *)malloc(n*sizeof(*ring));
+  if (!m || !ring) ERROR("malloc() failed");
+  for (unsigned long i=0; i<n; i++)
+    ring[i].seq=i;
+  m->tail=0;
+  m->head=0;
+  m->mask=n-1;
+  m->ring=ring;
+  return m;
+}
+
+extern int deq_mpmc_tail_put(Deq q, Data d) {
+  Mpmc m=mpmc(q);
+  unsigned long pos=__atomic_load_n(&m->tail,__ATOMIC_RELAXED);
+  Cell *c;
+  for (;;) {
+    c=&m->ring[pos & m->mask];
+    unsigned long seq=__atomic_load_n(&c->seq,__ATOMIC_ACQUIRE);
+    long dif=(long)(seq-pos);
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&m->tail,&pos,pos+1,1,
+                                      __ATOMIC_RELAXED,__ATOMIC_RELAXED))
+        break;                  // else pos was reloaded
+    } else if (dif < 0) {
+      return 0;                 // full
+    } else {
+      pos=__atomic_load_n(&m->tail,__ATOMIC_RELAXED);
+    }
+  }
+  c->data=d;
+  __atomic_store_n(&c->seq,pos+1,__ATOMIC_RELEASE);
+  return 1;
+}
+
+extern int deq_mpmc_head_get(Deq q, Data *d) {
+  Mpmc m=mpmc(q);
+  unsigned long pos=__atomic_load_n(&m->head,__ATOMIC_RELAXED);
+  Cell *c;
+  for (;;) {
+    c=&m->ring[pos & m->mask];
+    unsigned long seq=__atomic_load_n(&c->seq,__ATOMIC_ACQUIRE);
+    long dif=(long)(seq-(pos+1));
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&m->head,&pos,pos+1,1,
+                                      __ATOMIC_RELAXED,__ATOMIC_RELAXED))
+        break;
+    } else if (dif < 0) {
+      return 0;                 // empty
+    } else {
+      pos=__atomic_load_n(&m->head,__ATOMIC_RELAXED);
+    }
+  }
+  *d=c->data;
+  __atomic_store_n(&c->seq,pos+m->mask+1,__ATOMIC_RELEASE);
+  return 1;
+}
+
+extern int deq_mpmc_len(Deq q) {
+  Mpmc m=mpmc(q);
+  unsigned long h=__atomic_load_n(&m->head,__ATOMIC_ACQUIRE);
+  unsigned long t=__atomic_load_n(&m->tail,__ATOMIC_ACQUIRE);
+  return t>h ? t-h : 0;
+}
+
+extern void deq_mpmc_del(Deq q) {
+  Mpmc m=mpmc(q);
+  free(m->ring);
+  free(m);
+}
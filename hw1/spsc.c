@@ -0,0 +1,83 @@
+/**
+ * @file spsc.c
+ * @brief A lock-free, bounded, single-producer/single-consumer deque.
+ *
+ * One thread puts at the tail, and one (other) thread gets from the head,
+ * of a ring of power-of-two size. Each side owns one index, on a cache line
+ * of its own, and only ever reads the other's index with acquire ordering,
+ * after publishing its own slot with release ordering. Each side also keeps
+ * a cached copy of the other's index, so the shared line is only touched
+ * when the ring looks full (to the producer) or empty (to the consumer).
+ */
+
+#include <stdlib.h>
+
+#include "deq.h"
+#include "error.h"
+
+#define Line 64                 // cache-line size
+
+typedef struct {
+  _Alignas(Line) unsigned long tail; // next slot to put; producer's
+  unsigned long headc;          // producer's copy of head
+  _Alignas(Line) unsigned long head; // next slot to get; consumer's
+  unsigned long tailc;          // consumer's copy of tail
+  _Alignas(Line) unsigned long mask; // ring size - 1
+  Data *ring;
+} *Spsc;
+
+static Spsc spsc(Deq q) {
+  if (!q) ERROR("zero pointer");
+  return (Spsc)q;
+}
+
+extern Deq deq_spsc_new(int cap) {
+  if (cap < 1) ERROR("capacity must be positive");
+  unsigned long n=1;
+  while (n < (unsigned long)cap) n*=2;
+  Spsc s=(Spsc)aligned_alloc(Line,sizeof(*s));
+  Data *ring=(Data *)malloc(n*sizeof(*ring));
+  if (!s || !ring) ERROR("malloc() failed");
+  s->tail=s->headc=0;
+  s->head=s->tailc=0;
+  s->mask=n-1;
+  s->ring=ring;
+  return s;
+}
+
+extern int deq_spsc_tail_put(Deq q, Data d) {
+  Spsc s=spsc(q);
+  unsigned long t=s->tail;
+  if (t-s->headc > s->mask) {
+    s->headc=__atomic_load_n(&s->head,__ATOMIC_ACQUIRE);
+    if (t-s->headc > s->mask) return 0;   // full
+  }
+  s->ring[t & s->mask]=d;
+  __atomic_store_n(&s->tail,t+1,__ATOMIC_RELEASE);
+  return 1;
+}
+
+extern int deq_spsc_head_get(Deq q, Data *d) {
+  Spsc s=spsc(q);
+  unsigned long h=s->head;
+  if (h == s->tailc) {
+    s->tailc=__atomic_load_n(&s->tail,__ATOMIC_ACQUIRE);
+    if (h == s->tailc) return 0;          // empty
+  }
+  *d=s->ring[h & s->mask];
+  __atomic_store_n(&s->head,h+1,__ATOMIC_RELEASE);
+  return 1;
+}
+
+extern int deq_spsc_len(Deq q) {
+  Spsc s=spsc(q);
+  unsigned long h=__atomic_load_n(&s->head,__ATOMIC_ACQUIRE);
+  unsigned long t=__atomic_load_n(&s->tail,__ATOMIC_ACQUIRE);
+  return t-h;
+}
+
+extern void deq_spsc_del(Deq q) {
+  Spsc s=spsc(q);
+  free(s->ring);
+  free(s);
+}
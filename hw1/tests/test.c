@@ -14,6 +14,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
 #include "../deq.h"
 
 /* -------------------------------------------------------------------------
@@ -303,6 +307,1063 @@ static void test_large() {
     deq_del(q, NULL);
 }
 
+/* -------------------------------------------------------------------------
+   Test 7: Node recycling
+   - Streams items through the queue so nodes are recycled many times
+   - Removes items by value from the middle, returning nodes out of order
+   - Checks that order and length survive node reuse
+   ------------------------------------------------------------------------- */
+static void test_recycle() {
+    Deq q = deq_new();
+    int ok = 1;
+
+    // Keep ~1000 items queued while 20000 pass through
+    for (long i = 0; i < 20000; i++) {
+        deq_tail_put(q, (Data)(i + 1));
+        if (i >= 1000 && (long)deq_head_get(q) != i - 999) ok = 0;
+    }
+    test(ok, "FIFO order kept while streaming through recycled nodes");
+    test(deq_len(q) == 1000, "Length == 1000 after streaming");
+
+    // Remove every other item by value, then drain from the tail
+    for (long i = 19001; i <= 20000; i += 2)
+        if ((long)deq_head_rem(q, (Data)i) != i) ok = 0;
+    test(ok && deq_len(q) == 500, "Removed 500 items by value");
+    for (long i = 20000; i > 19000; i -= 2)
+        if ((long)deq_tail_get(q) != i) ok = 0;
+    test(ok && deq_len(q) == 0, "Drained remaining items from tail in order");
+
+    // Reuse the (now empty) queue
+    deq_head_put(q, "again");
+    test(strcmp((char*)deq_tail_ith(q, 0), "again") == 0, "Queue reusable after draining");
+
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 8: Indexed access under mixed operations
+   - Mirrors a deque in a plain array while putting, getting and removing
+   - Interleaves head_ith/tail_ith so the index is built, kept and rebuilt
+   - Checks every position from both ends against the mirror
+   - Leaves gaps in the index through a cursor, refills some, and drains it
+   ------------------------------------------------------------------------- */
+static void test_ith_mixed() {
+    enum { Max = 4096 };
+    static long mirror[2 * Max];
+    long lo = Max, hi = Max;    // mirror[lo..hi) holds the deque, head first
+    Deq q = deq_new();
+    int ok = 1;
+
+    srand(452);
+    for (long i = 1; i <= 20000; i++) {
+        int op = rand() % 8;
+        if (op < 3 && hi < 2 * Max) {
+            deq_tail_put(q, (Data)i); mirror[hi++] = i;
+        } else if (op < 6 && lo > 0) {
+            deq_head_put(q, (Data)i); mirror[--lo] = i;
+        } else if (op == 6 && hi > lo) {
+            if ((long)deq_head_get(q) != mirror[lo++]) ok = 0;
+        } else if (hi - lo > 2) {
+            // remove from the middle; shift the mirror's tail down
+            long k = lo + 1 + rand() % (hi - lo - 2);
+            if ((long)deq_tail_rem(q, (Data)mirror[k]) != mirror[k]) ok = 0;
+            memmove(&mirror[k], &mirror[k + 1], (hi - k - 1) * sizeof(long));
+            hi--;
+        }
+        if (hi > lo && i % 7 == 0) {
+            long k = rand() % (hi - lo);
+            if ((long)deq_head_ith(q, k) != mirror[lo + k]) ok = 0;
+            if ((long)deq_tail_ith(q, k) != mirror[hi - 1 - k]) ok = 0;
+        }
+    }
+    test(deq_len(q) == hi - lo, "Length matches mirror after mixed operations");
+    for (long k = 0; k < hi - lo; k++)
+        if ((long)deq_head_ith(q, k) != mirror[lo + k] ||
+            (long)deq_tail_ith(q, k) != mirror[hi - 1 - k]) ok = 0;
+    test(ok, "head_ith/tail_ith match mirror at every position");
+    deq_del(q, NULL);
+
+    // Leave gaps in the index through a cursor, then fill some again:
+    // 0 1 2 3 4 5 ... => 0 2 3 5 ... => 0 1002 2 3 1005 5 ...
+    enum { N = 100000 };
+    q = deq_new();
+    for (long i = 0; i < N; i++) deq_tail_put(q, (Data)i);
+    struct mallinfo2 m0 = mallinfo2();
+    deq_head_ith(q, 0);
+    DeqIter it = deq_head_iter(q);
+    for (long i = 0; i < N; i++)
+        if (i % 3 == 1) deq_iter_rem(it); else deq_iter_next(it);
+    deq_iter_del(it);
+    long n = 0;
+    for (long i = 0; i < N; i++)
+        if (i % 3 != 1) n++;
+    ok = deq_len(q) == n;
+    for (long k = 0; ok && k < n; k += 97)
+        ok = (long)deq_head_ith(q, k) == k / 2 * 3 + k % 2 * 2 &&
+             (long)deq_tail_ith(q, k) == (n - 1 - k) / 2 * 3 + (n - 1 - k) % 2 * 2;
+    test(ok, "ith after removals from the middle");
+
+    it = deq_head_iter(q);
+    for (long i = 0; deq_iter_ok(it); i++) {
+        if (i % 2) deq_iter_put(it, (Data)((long)deq_iter_data(it) + 1000));
+        deq_iter_next(it);
+    }
+    deq_iter_del(it);
+    ok = deq_len(q) == n + n / 2;
+    for (long k = 0; ok && k < n + n / 2; k += 89) {
+        long j = k / 3 * 2 + (k % 3 != 0);       // position before the inserts
+        long v = j / 2 * 3 + j % 2 * 2;
+        ok = (long)deq_head_ith(q, k) == (k % 3 == 1 ? v + 1000 : v);
+    }
+    test(ok, "ith after insertions into the gaps");
+#ifdef DEQ_STATS
+    DeqStats s;
+    deq_stats(q, &s);
+    test(s.ith_walk[0] == N && s.ith_walk[1] == 0, "The index is built once, and never rebuilt");
+#endif
+
+    Data d[1000];
+    while (deq_head_get_n(q, d, 1000)) ;
+    struct mallinfo2 m1 = mallinfo2();
+    test(m1.uordblks + m1.hblkhd < m0.uordblks + m0.hblkhd + N * sizeof(Data) / 4,
+         "Draining a deque frees its index");
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 9: Hashed deque
+   - Runs the same random puts, gets and rems on a plain and a hashed deque
+   - Uses few distinct values, so duplicates exercise head-first/tail-first
+   - Checks every result, and the final contents, agree
+   ------------------------------------------------------------------------- */
+static void test_hash() {
+    Deq p = deq_new();
+    Deq h = deq_hash_new();
+    int ok = 1;
+
+    test(h != NULL && deq_len(h) == 0, "Create new hashed Deq");
+
+    srand(4520);
+    for (int i = 0; i < 20000; i++) {
+        Data d = (Data)(long)(rand() % 50);   // includes 0 as a value
+        switch (rand() % 6) {
+        case 0: deq_head_put(p, d); deq_head_put(h, d); break;
+        case 1: deq_tail_put(p, d); deq_tail_put(h, d); break;
+        case 2: if (deq_head_get(p) != deq_head_get(h)) ok = 0; break;
+        case 3: if (deq_tail_get(p) != deq_tail_get(h)) ok = 0; break;
+        case 4: if (deq_head_rem(p, d) != deq_head_rem(h, d)) ok = 0; break;
+        case 5: if (deq_tail_rem(p, d) != deq_tail_rem(h, d)) ok = 0; break;
+        }
+        if (deq_len(p) != deq_len(h)) ok = 0;
+    }
+    test(ok, "Hashed deque results match plain deque");
+    for (int k = 0; ok && k < deq_len(p); k++)
+        if (deq_head_ith(p, k) != deq_head_ith(h, k)) ok = 0;
+    test(ok, "Hashed deque contents match plain deque");
+
+    // Not-found and emptied cases
+    test(deq_head_rem(h, (Data)999L) == NULL, "Hashed rem of missing value => NULL");
+    while (deq_len(h)) deq_tail_get(h);
+    test(deq_tail_rem(h, (Data)1L) == NULL, "Hashed rem on empty => NULL");
+
+    deq_del(p, NULL);
+    deq_del(h, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 10: Bulk put/get
+   - Puts batches at both ends of a hashed deque, after indexing it
+   - Checks the order matches single puts, from both ends
+   - Gets batches from both ends, including more than are left
+   ------------------------------------------------------------------------- */
+static void test_bulk() {
+    Data src[] = {"a", "b", "c", "d"};
+    Data dst[8];
+    Deq q = deq_hash_new();
+
+    deq_tail_put(q, "x");
+    test(strcmp((char*)deq_head_ith(q, 0), "x") == 0, "head_ith(0) = x before bulk puts");
+    deq_tail_put_n(q, src, 4);
+    deq_head_put_n(q, src, 4);
+    // d c b a x a b c d
+    test(deq_len(q) == 9, "Length == 9 after two put_n of 4");
+    test(strcmp((char*)deq_head_ith(q, 0), "d") == 0, "head_ith(0) = d");
+    test(strcmp((char*)deq_head_ith(q, 4), "x") == 0, "head_ith(4) = x");
+    test(strcmp((char*)deq_tail_ith(q, 0), "d") == 0, "tail_ith(0) = d");
+    test(strcmp((char*)deq_tail_ith(q, 3), "a") == 0, "tail_ith(3) = a");
+    test(deq_tail_rem(q, "a") == src[0] && deq_len(q) == 8, "Hashed rem after put_n");
+
+    // d c b a x b c d
+    int n = deq_head_get_n(q, dst, 3);
+    test(n == 3 && dst[0] == src[3] && dst[2] == src[1], "head_get_n(3) => d c b");
+    n = deq_tail_get_n(q, dst, 2);
+    test(n == 2 && dst[0] == src[3] && dst[1] == src[2], "tail_get_n(2) => d c");
+    test(strcmp((char*)deq_head_ith(q, 1), "x") == 0, "head_ith(1) = x after bulk gets");
+    n = deq_tail_get_n(q, dst, 8);
+    test(n == 3 && deq_len(q) == 0, "tail_get_n(8) on 3 items => 3, now empty");
+    test(deq_head_get_n(q, dst, 1) == 0, "head_get_n on empty => 0");
+    deq_head_put_n(q, src, 2);
+    test(deq_len(q) == 2 && deq_tail_get(q) == src[0], "put_n into emptied deque");
+
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 11: Splice
+   - Splices deques onto both ends, checking order and that sources empty
+   - Covers hashed/plain combinations and empty sources/destinations
+   - Keeps using both deques afterwards, so adopted nodes get recycled
+   - Deletes the sources of long splices first, and checks short splices
+     don't leave the sources' slabs behind
+   - Drains a deque that is always spliced onto, checking its nodes get reused
+   ------------------------------------------------------------------------- */
+static Deq deq_of(Deq q, const char *s) {
+    for (; *s; s++) deq_tail_put(q, (Data)(long)*s);
+    return q;
+}
+
+static int deq_is(Deq q, const char *s) {
+    if (deq_len(q) != (int)strlen(s)) return 0;
+    for (int i = 0; s[i]; i++)
+        if ((long)deq_head_ith(q, i) != s[i]) return 0;
+    return 1;
+}
+
+static void test_splice() {
+    Deq a = deq_of(deq_new(), "abc");
+    Deq b = deq_of(deq_new(), "de");
+    deq_splice_tail(a, b);
+    test(deq_is(a, "abcde") && deq_len(b) == 0, "splice_tail(abc, de) => abcde, src empty");
+    deq_of(b, "xy");
+    deq_splice_head(a, b);
+    test(deq_is(a, "xyabcde") && deq_len(b) == 0, "splice_head(abcde, xy) => xyabcde");
+    deq_splice_tail(a, b);
+    test(deq_is(a, "xyabcde"), "splice of empty src is a no-op");
+    deq_splice_tail(b, a);
+    test(deq_is(b, "xyabcde") && deq_len(a) == 0, "splice into empty dst");
+
+    // Recycle adopted nodes in both deques
+    for (int i = 0; i < 100; i++) {
+        deq_tail_put(a, deq_head_get(b));
+        deq_tail_put(b, deq_head_get(a));
+    }
+    test(deq_is(b, "abcdexy") && deq_len(a) == 0, "Deques usable after splicing");
+
+    Deq h = deq_of(deq_hash_new(), "aba");
+    Deq g = deq_of(deq_hash_new(), "bab");
+    deq_splice_tail(h, g);
+    test(deq_is(h, "ababab"), "splice_tail of hashed deques");
+    deq_head_rem(h, (Data)(long)'b');
+    deq_tail_rem(h, (Data)(long)'a');
+    test(deq_is(h, "aabb"), "Hashed rem after splice keeps end semantics");
+    deq_of(g, "ca");
+    deq_splice_head(h, deq_of(a, "xa"));   // plain into hashed
+    deq_splice_tail(b, g);                 // hashed into plain
+    test(deq_is(h, "xaaabb") && deq_head_rem(h, (Data)(long)'x') && deq_is(h, "aaabb"),
+         "splice_head of plain into hashed");
+    test(deq_is(b, "abcdexyca") && deq_tail_rem(b, (Data)(long)'a'), "splice_tail of hashed into plain");
+    for (int i = 0; i < 50; i++) deq_head_put(b, (Data)(long)'z');
+
+    // Mix the slabs of longer deques, then delete all but one of them
+    Deq x = deq_new(), y = deq_new(), z = deq_new();
+    for (long i = 0; i < 1000; i++) {
+        deq_tail_put(x, (Data)i);
+        deq_tail_put(y, (Data)(1000 + i));
+        deq_tail_put(z, (Data)(2000 + i));
+    }
+    deq_splice_tail(x, y);
+    Deq w = deq_split(x, 500);
+    deq_splice_head(z, w);
+    deq_splice_tail(y, z);
+    deq_del(x, NULL);
+    deq_del(w, NULL);
+    deq_del(z, NULL);
+    for (int i = 0; i < 5000; i++) deq_tail_put(y, deq_head_get(y));
+    int ok = deq_len(y) == 2500;
+    for (long i = 0; ok && i < 2500; i++) ok = deq_head_get(y) == (Data)(500 + i);
+    test(ok, "Spliced nodes outlive the deques they came from");
+
+    struct mallinfo2 m0 = mallinfo2();
+    for (long i = 0; i < 40000; i++) {
+        Deq s = deq_new();
+        deq_tail_put(s, (Data)i);
+        deq_splice_tail(y, s);
+        deq_del(s, NULL);
+    }
+    struct mallinfo2 m1 = mallinfo2();
+    test(deq_len(y) == 40000 && m1.uordblks + m1.hblkhd < m0.uordblks + m0.hblkhd + (4 << 20),
+         "Splicing short deques does not keep their slabs");
+
+    Deq worker = deq_new(), shared = deq_new();
+    m0 = mallinfo2();
+    for (int k = 0; k < 2000; k++) {
+        for (long i = 0; i < 1000; i++) deq_tail_put(worker, (Data)i);
+        deq_splice_tail(shared, worker);
+        while (deq_len(shared)) deq_head_get(shared);
+    }
+    m1 = mallinfo2();
+    test(m1.uordblks + m1.hblkhd < m0.uordblks + m0.hblkhd + (4 << 20),
+         "Nodes spliced one way are freed for reuse");
+    deq_del(worker, NULL);
+    deq_del(shared, NULL);
+
+    deq_del(a, NULL);
+    deq_del(b, NULL);
+    deq_del(g, NULL);
+    deq_del(h, NULL);
+    deq_del(y, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 12: Split
+   - Splits plain and hashed deques at the ends and in the middle
+   - Locates the split point with and without a valid index
+   - Deletes the original before the split-off part, which still uses its nodes
+   - Frees the nodes of split-off parts as they are deleted
+   - Works on the two halves of a split from two threads at once
+   ------------------------------------------------------------------------- */
+#define SplitPuts 20000
+
+// Grows and drains one half of a split, then deletes it
+static void *split_worker(void *arg) {
+    Deq q = arg;
+    int n = deq_len(q);
+    Data first = deq_head_ith(q, 0);
+    long ok = 1;
+    for (long i = 0; i < SplitPuts; i++) deq_tail_put(q, (Data)i);
+    for (long i = SplitPuts - 1; i >= 0; i--) ok &= deq_tail_get(q) == (Data)i;
+    ok &= deq_len(q) == n && deq_head_ith(q, 0) == first;
+    deq_del(q, NULL);
+    return (void *)ok;
+}
+
+static void test_split() {
+    Deq q = deq_of(deq_new(), "abcdefg");
+    Deq t = deq_split(q, 5);
+    test(deq_is(q, "abcde") && deq_is(t, "fg"), "split(abcdefg, 5) => abcde | fg");
+    Deq u = deq_split(q, 1);               // index was built by deq_is
+    test(deq_is(q, "a") && deq_is(u, "bcde"), "split(abcde, 1) => a | bcde");
+    Deq v = deq_split(u, 4);
+    test(deq_is(u, "bcde") && deq_len(v) == 0, "split at len => empty new deque");
+    Deq w = deq_split(u, 0);
+    test(deq_len(u) == 0 && deq_is(w, "bcde"), "split at 0 => everything moves");
+
+    deq_head_put(q, (Data)(long)'z');
+    deq_tail_get(q);
+    test(deq_is(q, "z"), "Original deque usable after split");
+    deq_del(q, NULL);
+    for (int i = 0; i < 100; i++) deq_tail_put(w, deq_head_get(w));
+    test(deq_is(w, "bcde"), "Split-off deque usable after original deleted");
+    deq_splice_tail(w, t);
+    test(deq_is(w, "bcdefg"), "Splice after split");
+
+    Deq h = deq_of(deq_hash_new(), "abcabc");
+    Deq g = deq_split(h, 3);
+    test(deq_is(h, "abc") && deq_is(g, "abc"), "split of hashed deque");
+    test(deq_tail_rem(h, (Data)(long)'a') && deq_is(h, "bc") && deq_is(g, "abc"),
+         "Hashed rem only sees the remaining half");
+    test(deq_head_rem(g, (Data)(long)'c') && deq_is(g, "ab"), "Hashed rem in split-off half");
+
+    Deq p = deq_new();
+    struct mallinfo2 m0 = mallinfo2();
+    for (int k = 0; k < 2000; k++) {
+        for (long i = 0; i < 1000; i++) deq_tail_put(p, (Data)i);
+        deq_del(deq_split(p, 0), NULL);
+    }
+    struct mallinfo2 m1 = mallinfo2();
+    test(deq_len(p) == 0 && m1.uordblks + m1.hblkhd < m0.uordblks + m0.hblkhd + (4 << 20),
+         "Deleting split-off parts frees their nodes");
+    deq_del(p, NULL);
+
+    Deq halves[2];
+    halves[0] = deq_sync_new();
+    for (long i = 0; i < 1000; i++) deq_tail_put(halves[0], (Data)i);
+    halves[1] = deq_split(halves[0], 500);
+    pthread_t th[2];
+    void *res[2];
+    for (int k = 0; k < 2; k++) pthread_create(&th[k], NULL, split_worker, halves[k]);
+    for (int k = 0; k < 2; k++) pthread_join(th[k], &res[k]);
+    test(res[0] && res[1], "Halves of a split work in two threads at once");
+
+    deq_del(h, NULL);
+    deq_del(g, NULL);
+    deq_del(t, NULL);
+    deq_del(u, NULL);
+    deq_del(v, NULL);
+    deq_del(w, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 13: Cursors
+   - Walks from each end, and back, checking the elements seen
+   - Removes and inserts in the middle and at both ends through a cursor
+   - Repeats the edits on a hashed deque and checks its rem semantics
+   - Keeps using cursors across splices into their deque and splits at its length
+   - Using a cursor after a splice or split from its deque is not checked,
+     because it calls ERROR() and exits
+   ------------------------------------------------------------------------- */
+static void test_iter() {
+    Deq q = deq_of(deq_new(), "abcde");
+    char seen[8] = "";
+    int k = 0;
+
+    DeqIter it = deq_tail_iter(q);
+    for (; deq_iter_ok(it); deq_iter_next(it)) seen[k++] = (long)deq_iter_data(it);
+    test(strcmp(seen, "edcba") == 0, "Tail cursor visits edcba");
+    deq_iter_prev(it);
+    test((long)deq_iter_data(it) == 'a', "prev from off the end => a");
+    deq_iter_del(it);
+
+    for (int h = 0; h < 2; h++) {
+        Deq d = h ? deq_of(deq_hash_new(), "abcabc") : deq_of(deq_new(), "abcabc");
+        it = deq_head_iter(d);
+        deq_iter_next(it);
+        test((long)deq_iter_rem(it) == 'b' && (long)deq_iter_data(it) == 'c', "rem in middle moves to next");
+        deq_iter_put(it, (Data)(long)'x');      // a x c a b c
+        deq_iter_put(it, (Data)(long)'a');      // a x a c a b c
+        test((long)deq_iter_data(it) == 'c', "put keeps cursor on current");
+        deq_iter_prev(it); deq_iter_prev(it); deq_iter_prev(it);
+        deq_iter_put(it, (Data)(long)'z');      // z a x a c a b c
+        while (deq_iter_ok(it)) deq_iter_next(it);
+        deq_iter_put(it, (Data)(long)'y');      // z a x a c a b c y
+        test(deq_is(d, "zaxacabcy"), h ? "Cursor edits on hashed deque" : "Cursor edits on plain deque");
+        deq_iter_prev(it);
+        test((long)deq_iter_rem(it) == 'y' && !deq_iter_ok(it), "rem at far end => off the deque");
+        deq_iter_del(it);
+
+        // second 'a' from the tail is the one the cursor inserted
+        deq_tail_rem(d, (Data)(long)'a');
+        deq_tail_rem(d, (Data)(long)'a');
+        deq_head_rem(d, (Data)(long)'a');
+        test(deq_is(d, "zxcbc"), h ? "Hashed rem after cursor inserts" : "Plain rem after cursor inserts");
+        deq_del(d, NULL);
+    }
+
+    it = deq_head_iter(q);
+    while (deq_iter_ok(it))
+        if ((long)deq_iter_data(it) % 2) deq_iter_rem(it); else deq_iter_next(it);
+    test(deq_is(q, "bd"), "Removing odd elements in one pass => bd");
+    deq_iter_del(it);
+
+    it = deq_head_iter(q);
+    deq_iter_next(it);
+    Deq s = deq_of(deq_new(), "a");
+    deq_splice_head(q, s);
+    Deq e = deq_split(q, 3);
+    test((long)deq_iter_rem(it) == 'd' && deq_is(q, "ab") && deq_len(e) == 0,
+         "Cursor survives splices into its deque and splits at its length");
+    deq_iter_del(it);
+    deq_del(s, NULL);
+    deq_del(e, NULL);
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 14: Context-carrying and early-exit maps
+   - Collects elements in order and in reverse through a context pointer
+   - Stops searches at the first match from either end
+   ------------------------------------------------------------------------- */
+static void collect(Data d, void *ctx) {
+    char *s = ctx;
+    s[strlen(s)] = (long)d;
+}
+
+static int count_until(Data d, void *ctx) {
+    long *c = ctx;      // c[0]: value sought, c[1]: calls made
+    c[1]++;
+    return (long)d == c[0];
+}
+
+static void test_map_ctx() {
+    Deq q = deq_of(deq_new(), "abcb");
+    char s[8] = "";
+    deq_map_ctx(q, collect, s);
+    test(strcmp(s, "abcb") == 0, "map_ctx visits abcb");
+    memset(s, 0, sizeof(s));
+    deq_map_rev_ctx(q, collect, s);
+    test(strcmp(s, "bcba") == 0, "map_rev_ctx visits bcba");
+
+    long c[2] = {'b', 0};
+    test(deq_map_until(q, count_until, c) == 1 && c[1] == 2, "map_until stops at head index 1 after 2 calls");
+    c[1] = 0;
+    test(deq_map_rev_until(q, count_until, c) == 0 && c[1] == 1, "map_rev_until stops at tail index 0 after 1 call");
+    c[0] = 'z'; c[1] = 0;
+    test(deq_map_until(q, count_until, c) == -1 && c[1] == 4, "map_until without a match => -1");
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 15: Parallel map
+   - Maps over a large deque with several threads, counting visits per element
+   - Checks every element was visited exactly once, above and below threshold
+   - Checks callbacks overlap, from the first call on, but on at most
+     nthreads threads
+   ------------------------------------------------------------------------- */
+enum { ParLen = 50000 };
+static int par_visits[ParLen];
+static int par_active, par_peak;
+
+static void par_overlap(Data d) {
+    int n = __atomic_add_fetch(&par_active, 1, __ATOMIC_RELAXED);
+    for (int p = __atomic_load_n(&par_peak, __ATOMIC_RELAXED); n > p && !__atomic_compare_exchange_n(&par_peak, &p, n, 1,
+                                                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED); )
+        ;
+    if ((long)d % 500 == 0) usleep(1000);       // let other threads in
+    __atomic_sub_fetch(&par_active, 1, __ATOMIC_RELAXED);
+}
+
+static void par_visit(Data d) {
+    __atomic_fetch_add(&par_visits[(long)d], 1, __ATOMIC_RELAXED);
+}
+
+static int par_all(int n) {
+    for (int i = 0; i < ParLen; i++)
+        if (par_visits[i] != n) return 0;
+    return 1;
+}
+
+static void test_map_parallel() {
+    Deq q = deq_new();
+    for (long i = 0; i < ParLen; i++) deq_tail_put(q, (Data)i);
+
+    deq_map_parallel(q, par_overlap, 4);        // the first parallel job
+    test(par_peak > 1 && par_peak <= 4, "map_parallel(4 threads) overlaps on at most 4");
+    par_peak = 0;
+    deq_map_parallel(q, par_overlap, 2);
+    test(par_peak > 1 && par_peak <= 2, "map_parallel(2 threads) overlaps on at most 2");
+
+    deq_map_parallel(q, par_visit, 4);
+    test(par_all(1), "map_parallel(4 threads) visits each element once");
+    deq_map_parallel(q, par_visit, 0);
+    test(par_all(2), "map_parallel(one per CPU) visits each element once");
+    int old = deq_map_parallel_min(ParLen + 1);
+    deq_map_parallel(q, par_visit, 4);
+    test(par_all(3), "map_parallel below threshold visits each element once");
+    deq_map_parallel_min(old);
+    deq_head_rem(q, (Data)(long)(ParLen / 2));   // invalidates the index
+    deq_map_parallel(q, par_visit, 3);
+    test(par_visits[ParLen / 2] == 3 && par_visits[0] == 4 && par_visits[ParLen - 1] == 4,
+         "map_parallel after a middle rem");
+
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 16: deq_str edge cases and size
+   - Checks empty deques and empty elements keep the historical spacing
+   - Renders a long deque, with and without a conversion function
+   ------------------------------------------------------------------------- */
+static char* dup_str(Data d) {
+    return strdup((char*)d);
+}
+
+static void test_str() {
+    Deq q = deq_new();
+    char *s = deq_str(q, NULL);
+    test(strcmp(s, "") == 0, "deq_str of empty deque => ''");
+    free(s);
+
+    deq_tail_put(q, "");
+    deq_tail_put(q, "a");
+    deq_tail_put(q, "");
+    deq_tail_put(q, "b");
+    s = deq_str(q, NULL);
+    test(strcmp(s, "a  b") == 0, "deq_str skips separators until nonempty => 'a  b'");
+    free(s);
+    s = deq_str(q, dup_str);
+    test(strcmp(s, "a  b") == 0, "deq_str with function, same spacing");
+    free(s);
+    while (deq_len(q)) deq_head_get(q);
+
+    for (int i = 0; i < 10000; i++) deq_tail_put(q, "xyz");
+    s = deq_str(q, NULL);
+    test(strlen(s) == 10000 * 4 - 1 && strncmp(s, "xyz xyz", 7) == 0, "deq_str of 10000 elements");
+    free(s);
+    s = deq_str(q, starify);
+    test(strlen(s) == 10000 * 6 - 1 && strncmp(s, "*xyz* *xyz*", 11) == 0, "deq_str of 10000 with starify");
+    free(s);
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 17: Streaming output
+   - Writes deques to a temporary file with deq_write and deq_fprint
+   - Uses enough elements to flush the iovec array and buffer many times
+   - Checks the file holds exactly what deq_str returns
+   ------------------------------------------------------------------------- */
+static int streams_like_str(Deq q, DeqStrF f, int use_fd) {
+    FILE *fp = tmpfile();
+    long n = use_fd ? deq_write(q, f, fileno(fp)) : deq_fprint(q, f, fp);
+    fflush(fp);
+    char *want = deq_str(q, f);
+    long len = (long)strlen(want);
+    char *got = malloc(len + 1);
+    int ok = n == len && pread(fileno(fp), got, len + 1, 0) == len && memcmp(got, want, len) == 0;
+    free(got);
+    free(want);
+    fclose(fp);
+    return ok;
+}
+
+static void test_write() {
+    Deq q = deq_new();
+    test(streams_like_str(q, NULL, 1), "deq_write of empty deque");
+    deq_tail_put(q, "");
+    deq_tail_put(q, "a");
+    deq_tail_put(q, "");
+    test(streams_like_str(q, NULL, 1), "deq_write keeps deq_str spacing");
+    test(streams_like_str(q, starify, 0), "deq_fprint keeps deq_str spacing");
+
+    static char big[10000];
+    memset(big, 'b', sizeof(big) - 1);
+    for (int i = 0; i < 5000; i++) deq_tail_put(q, i % 1000 ? "item" : big);
+    test(streams_like_str(q, NULL, 1), "deq_write of 5000 elements, zero-copy");
+    test(streams_like_str(q, starify, 1), "deq_write of 5000 elements, converted");
+    test(streams_like_str(q, starify, 0), "deq_fprint of 5000 elements");
+    test(deq_write(q, NULL, -1) == -1, "deq_write to a bad fd => -1");
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 18: In-place formatting
+   - Formats integers with an snprintf-style callback
+   - Includes elements longer than the spare capacity, forcing a retry
+   ------------------------------------------------------------------------- */
+static size_t fmt_long(Data d, char *buf, size_t cap) {
+    return snprintf(buf, cap, "%ld", (long)d);
+}
+
+static size_t fmt_wide(Data d, char *buf, size_t cap) {
+    return snprintf(buf, cap, "%0100ld", (long)d);
+}
+
+static void test_str_fmt() {
+    Deq q = deq_new();
+    char *s = deq_str_fmt(q, fmt_long);
+    test(strcmp(s, "") == 0, "deq_str_fmt of empty deque => ''");
+    free(s);
+    for (long i = -2; i < 1000; i++) deq_tail_put(q, (Data)i);
+    s = deq_str_fmt(q, fmt_long);
+    test(strncmp(s, "-2 -1 0 1 2", 11) == 0 && strcmp(s + strlen(s) - 7, "998 999") == 0,
+         "deq_str_fmt of -2..999");
+    free(s);
+    s = deq_str_fmt(q, fmt_wide);
+    test(strlen(s) == 1002 * 101 - 1 && s[100] == ' ' && s[200] == '1', "deq_str_fmt retries wide elements");
+    free(s);
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 19: Synchronized deque
+   - Several threads put at the tail and get from the head at once
+   - Checks nothing was lost or duplicated
+   ------------------------------------------------------------------------- */
+enum { SyncThreads = 4, SyncPuts = 20000 };
+
+static void *sync_worker(void *arg) {
+    Deq q = arg;
+    long sum = 0;
+    for (long i = 1; i <= SyncPuts; i++) {
+        deq_tail_put(q, (Data)i);
+        if (i % 2) sum += (long)deq_head_get(q);
+    }
+    return (void*)sum;
+}
+
+static void test_sync() {
+    Deq q = deq_sync_new();
+    pthread_t t[SyncThreads];
+    long sum = 0;
+    for (int k = 0; k < SyncThreads; k++) pthread_create(&t[k], NULL, sync_worker, q);
+    for (int k = 0; k < SyncThreads; k++) {
+        void *got;
+        pthread_join(t[k], &got);
+        sum += (long)got;
+    }
+    test(deq_len(q) == SyncThreads * SyncPuts / 2, "Sync deque length after concurrent puts/gets");
+    while (deq_len(q)) sum += (long)deq_head_get(q);
+    test(sum == (long)SyncThreads * SyncPuts * (SyncPuts + 1) / 2, "Sync deque lost and duplicated nothing");
+
+    Deq a = deq_of(deq_sync_new(), "ab");
+    deq_splice_tail(a, deq_of(q, "cd"));
+    Deq b = deq_split(a, 3);
+    test(deq_is(a, "abc") && deq_is(b, "d") && deq_len(q) == 0, "Sync splice and split");
+    deq_del(a, NULL);
+    deq_del(b, NULL);
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 20: Single-producer/single-consumer deque
+   - Checks capacity rounding, full and empty results on one thread
+   - Streams values from a producer thread to this one, checking order
+   ------------------------------------------------------------------------- */
+enum { SpscItems = 200000 };
+
+static void *spsc_producer(void *arg) {
+    for (long i = 1; i <= SpscItems; i++)
+        while (!deq_spsc_tail_put(arg, (Data)i))
+            sched_yield();
+    return NULL;
+}
+
+static void test_spsc() {
+    Deq q = deq_spsc_new(3);
+    Data d;
+    int ok = 1;
+    for (long i = 0; i < 4; i++) ok &= deq_spsc_tail_put(q, (Data)i);
+    test(ok && !deq_spsc_tail_put(q, "x") && deq_spsc_len(q) == 4, "SPSC cap 3 rounds to 4, then full");
+    for (long i = 0; i < 4; i++) ok &= deq_spsc_head_get(q, &d) && (long)d == i;
+    test(ok && !deq_spsc_head_get(q, &d) && deq_spsc_len(q) == 0, "SPSC gets in order, then empty");
+    deq_spsc_del(q);
+
+    q = deq_spsc_new(64);
+    pthread_t t;
+    pthread_create(&t, NULL, spsc_producer, q);
+    for (long i = 1; i <= SpscItems; i++) {
+        while (!deq_spsc_head_get(q, &d))
+            sched_yield();
+        if ((long)d != i) ok = 0;
+    }
+    pthread_join(t, NULL);
+    test(ok && deq_spsc_len(q) == 0, "SPSC streams 200000 items in order across threads");
+    deq_spsc_del(q);
+}
+
+/* -------------------------------------------------------------------------
+   Test 21: Work-stealing deque
+   - Checks LIFO owner gets and FIFO steals on one thread
+   - Owner puts (growing the array) and gets, while thieves steal
+   - Checks every element was taken exactly once
+   ------------------------------------------------------------------------- */
+enum { WsItems = 100000, WsThieves = 3 };
+static char ws_taken[WsItems + 1];
+static int ws_done;
+
+static void ws_take(Data d) {
+    __atomic_fetch_add(&ws_taken[(long)d], 1, __ATOMIC_RELAXED);
+}
+
+static void *ws_thief(void *arg) {
+    while (!__atomic_load_n(&ws_done, __ATOMIC_ACQUIRE) || deq_len(arg)) {
+        Data d = deq_head_steal(arg);
+        if (d) ws_take(d); else sched_yield();
+    }
+    return NULL;
+}
+
+static void test_ws() {
+    Deq q = deq_ws_new();
+    for (long i = 1; i <= 3; i++) deq_tail_put(q, (Data)i);
+    test((long)deq_head_steal(q) == 1 && (long)deq_tail_get(q) == 3, "WS steal takes head, owner gets tail");
+    test((long)deq_tail_get(q) == 2 && deq_tail_get(q) == NULL && deq_head_steal(q) == NULL,
+         "WS empty after last get");
+
+    pthread_t t[WsThieves];
+    for (int k = 0; k < WsThieves; k++) pthread_create(&t[k], NULL, ws_thief, q);
+    for (long i = 1; i <= WsItems; i++) {
+        deq_tail_put(q, (Data)i);
+        if (i % 3 == 0) {
+            Data d = deq_tail_get(q);
+            if (d) ws_take(d);
+        }
+    }
+    __atomic_store_n(&ws_done, 1, __ATOMIC_RELEASE);
+    for (int k = 0; k < WsThieves; k++) pthread_join(t[k], NULL);
+    int ok = deq_len(q) == 0;
+    for (long i = 1; i <= WsItems; i++) ok &= ws_taken[i] == 1;
+    test(ok, "WS every element taken exactly once, with concurrent thieves");
+    deq_del(q, NULL);
+
+    Deq s = deq_sync_new();
+    deq_tail_put(s, "a");
+    test(strcmp((char*)deq_head_steal(s), "a") == 0, "steal on a sync deque is head_get");
+    deq_del(s, NULL);
+
+    struct mallinfo2 m0 = mallinfo2();
+    q = deq_ws_new();
+    for (long i = 1; i <= 1000000; i++) deq_tail_put(q, (Data)i);
+    deq_del(q, NULL);
+    struct mallinfo2 m1 = mallinfo2();
+    test(m1.uordblks + m1.hblkhd < m0.uordblks + m0.hblkhd + (1 << 20),
+         "WS arrays are freed by deq_del");
+}
+
+/* -------------------------------------------------------------------------
+   Test 22: Multi-producer/multi-consumer deque
+   - Checks full and empty results, and wraparound, on one thread
+   - Runs several producers and consumers at once on a small ring
+   - Checks every element was gotten exactly once
+   ------------------------------------------------------------------------- */
+enum { MpmcPairs = 3, MpmcItems = 50000 };
+static char mpmc_got[MpmcPairs * MpmcItems];
+
+static void *mpmc_producer(void *arg) {
+    static int next;
+    long base = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) * MpmcItems;
+    for (long i = 0; i < MpmcItems; i++)
+        while (!deq_mpmc_tail_put(arg, (Data)(base + i)))
+            sched_yield();
+    return NULL;
+}
+
+static void *mpmc_consumer(void *arg) {
+    Data d;
+    for (long i = 0; i < MpmcItems; i++) {
+        while (!deq_mpmc_head_get(arg, &d))
+            sched_yield();
+        __atomic_fetch_add(&mpmc_got[(long)d], 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void test_mpmc() {
+    Deq q = deq_mpmc_new(4);
+    Data d;
+    int ok = 1;
+    for (long lap = 0; lap < 3; lap++) {
+        for (long i = 0; i < 4; i++) ok &= deq_mpmc_tail_put(q, (Data)i);
+        ok &= !deq_mpmc_tail_put(q, "x") && deq_mpmc_len(q) == 4;
+        for (long i = 0; i < 4; i++) ok &= deq_mpmc_head_get(q, &d) && (long)d == i;
+        ok &= !deq_mpmc_head_get(q, &d) && deq_mpmc_len(q) == 0;
+    }
+    test(ok, "MPMC full/empty and FIFO order over several laps");
+    deq_mpmc_del(q);
+
+    q = deq_mpmc_new(16);
+    pthread_t t[2 * MpmcPairs];
+    for (int k = 0; k < MpmcPairs; k++) {
+        pthread_create(&t[2 * k], NULL, mpmc_producer, q);
+        pthread_create(&t[2 * k + 1], NULL, mpmc_consumer, q);
+    }
+    for (int k = 0; k < 2 * MpmcPairs; k++) pthread_join(t[k], NULL);
+    for (long i = 0; i < MpmcPairs * MpmcItems; i++) ok &= mpmc_got[i] == 1;
+    test(ok && deq_mpmc_len(q) == 0, "MPMC every element gotten exactly once");
+    deq_mpmc_del(q);
+}
+
+/* -------------------------------------------------------------------------
+   Test 23: Blocking gets and puts with timeouts
+   - Checks a wait on an empty deque times out, and returns 0
+   - Checks a bounded deque's waiting put times out when full
+   - Runs a producer against a waiting consumer through a bounded deque
+   ------------------------------------------------------------------------- */
+enum { WaitItems = 20000 };
+
+static void *wait_producer(void *arg) {
+    for (long i = 1; i <= WaitItems; i++)
+        deq_tail_put_wait(arg, (Data)i, -1);
+    return NULL;
+}
+
+static void test_wait() {
+    Deq q = deq_sync_bounded_new(2);
+    test(deq_head_get_wait(q, 1000000) == 0, "Waiting get times out on an empty deque");
+    test(deq_tail_put_wait(q, "a", 0) && deq_tail_put_wait(q, "b", 0) &&
+         !deq_tail_put_wait(q, "c", 1000000) && deq_len(q) == 2,
+         "Waiting put times out on a full bounded deque");
+    test(strcmp(deq_head_get_wait(q, 0), "a") == 0 && deq_tail_get_wait(q, -1) &&
+         deq_len(q) == 0, "Waiting gets take what is there without waiting");
+
+    pthread_t t;
+    pthread_create(&t, NULL, wait_producer, q);
+    long ok = 1, max = 0;
+    for (long i = 1; i <= WaitItems; i++) {
+        ok &= (long)deq_head_get_wait(q, -1) == i;
+        if (deq_len(q) > max) max = deq_len(q);
+    }
+    pthread_join(t, NULL);
+    test(ok && max <= 2, "Waiting consumer gets every element in order, within cap");
+    deq_del(q, NULL);
+}
+
+/* -------------------------------------------------------------------------
+   Test 24: Lock-free deque
+   - Checks puts and gets at both ends on one thread
+   - Runs threads that put and get at both ends at once
+   - Checks every element was gotten exactly once
+   ------------------------------------------------------------------------- */
+enum { LfThreads = 4, LfItems = 50000 };
+static char lf_got[LfThreads * LfItems + 1];
+
+static void *lf_worker(void *arg) {
+    static int next;
+    long base = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) * LfItems + 1;
+    for (long i = 0; i < LfItems; i++) {
+        if (i % 2) deq_head_put(arg, (Data)(base + i));
+        else       deq_tail_put(arg, (Data)(base + i));
+        Data d = (i % 3) ? deq_head_get(arg) : deq_tail_get(arg);
+        if (d) __atomic_fetch_add(&lf_got[(long)d], 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void count_lf(Data d) { lf_got[(long)d]++; }
+
+static void test_lf() {
+    Deq q = deq_lf_new();
+    deq_tail_put(q, "b");
+    deq_head_put(q, "a");
+    deq_tail_put(q, "c");
+    test(deq_len(q) == 3, "Lock-free deque length after puts at both ends");
+    test(strcmp(deq_head_get(q), "a") == 0 && strcmp(deq_tail_get(q), "c") == 0 &&
+         strcmp(deq_tail_get(q), "b") == 0 && deq_head_get(q) == 0 &&
+         deq_tail_get(q) == 0, "Lock-free deque gets from both ends in order");
+    deq_del(q, NULL);
+
+    q = deq_lf_new();
+    pthread_t t[LfThreads];
+    for (int k = 0; k < LfThreads; k++) pthread_create(&t[k], NULL, lf_worker, q);
+    for (int k = 0; k < LfThreads; k++) pthread_join(t[k], NULL);
+    deq_del(q, count_lf);
+    int ok = 1;
+    for (long i = 1; i <= LfThreads * LfItems; i++) ok &= lf_got[i] == 1;
+    test(ok, "Lock-free deque every element gotten exactly once");
+}
+
+/* -------------------------------------------------------------------------
+   Test 25: Flat-combining deque
+   - Checks puts, gets and other operations on one thread
+   - Runs threads that put at the tail and get from the head at once
+   - Checks every element was gotten exactly once
+   ------------------------------------------------------------------------- */
+enum { FcThreads = 8, FcItems = 20000 };
+static char fc_got[FcThreads * FcItems + 1];
+
+static void *fc_worker(void *arg) {
+    static int next;
+    long base = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) * FcItems + 1;
+    for (long i = 0; i < FcItems; i++) {
+        deq_tail_put(arg, (Data)(base + i));
+        Data d = deq_head_get(arg);
+        if (d) __atomic_fetch_add(&fc_got[(long)d], 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void count_fc(Data d) { fc_got[(long)d]++; }
+
+static void test_fc() {
+    Deq q = deq_fc_new();
+    deq_of(q, "bc");
+    deq_head_put(q, (Data)(long)'a');
+    test(deq_is(q, "abc") && (long)deq_tail_get(q) == 'c' &&
+         (long)deq_head_get(q) == 'a' && deq_len(q) == 1,
+         "Flat-combining deque puts and gets at both ends");
+    Deq t = deq_split(q, 0);
+    deq_tail_put(t, (Data)(long)'d');
+    test(deq_len(q) == 0 && deq_is(t, "bd"), "Flat-combining deque splits into another");
+    deq_del(t, NULL);
+    deq_del(q, NULL);
+
+    q = deq_fc_new();
+    pthread_t th[FcThreads];
+    for (int k = 0; k < FcThreads; k++) pthread_create(&th[k], NULL, fc_worker, q);
+    for (int k = 0; k < FcThreads; k++) pthread_join(th[k], NULL);
+    deq_del(q, count_fc);
+    int ok = 1;
+    for (long i = 1; i <= FcThreads * FcItems; i++) ok &= fc_got[i] == 1;
+    test(ok, "Flat-combining deque every element gotten exactly once");
+}
+
+/* -------------------------------------------------------------------------
+   Test 26: Epoch-based reclamation
+   - Checks retired data is not freed while another thread is reading
+   - Checks it is all freed once that thread leaves
+   ------------------------------------------------------------------------- */
+static int ebr_freed, ebr_ready, ebr_go;
+
+static void ebr_count(Data d) { ebr_freed++; }
+
+static void *ebr_reader(void *arg) {
+    deq_ebr_enter();
+    deq_ebr_enter();            // nested: still inside after one exit
+    deq_ebr_exit();
+    __atomic_store_n(&ebr_ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&ebr_go, __ATOMIC_ACQUIRE)) sched_yield();
+    deq_ebr_exit();
+    return NULL;
+}
+
+static void test_ebr() {
+    pthread_t t;
+    pthread_create(&t, NULL, ebr_reader, NULL);
+    while (!__atomic_load_n(&ebr_ready, __ATOMIC_ACQUIRE)) sched_yield();
+    for (long i = 1; i <= 10; i++) deq_ebr_retire((Data)i, ebr_count);
+    test(deq_ebr_flush() >= 10 && ebr_freed == 0, "EBR holds back retired data during a read");
+    __atomic_store_n(&ebr_go, 1, __ATOMIC_RELEASE);
+    pthread_join(t, NULL);
+    test(deq_ebr_flush() == 0 && ebr_freed == 10, "EBR frees retired data once readers leave");
+}
+
+/* -------------------------------------------------------------------------
+   Test 27: Slab magazines
+   - Runs threads that each create, fill, drain and delete deques, so
+     slabs move between threads' magazines and the depot
+   - Repeats with magazines turned off
+   ------------------------------------------------------------------------- */
+enum { MagThreads = 4, MagRounds = 50, MagItems = 5000 };
+
+static void *mag_worker(void *arg) {
+    long ok = 1;
+    for (int r = 0; r < MagRounds; r++) {
+        Deq q = (r % 3) ? deq_new() : deq_hash_new();
+        for (long i = 1; i <= MagItems; i++) deq_tail_put(q, (Data)i);
+        for (long i = 1; i <= MagItems / 2; i++) ok &= (long)deq_head_get(q) == i;
+        ok &= deq_len(q) == MagItems - MagItems / 2;
+        deq_del(q, NULL);
+    }
+    return (void *)ok;
+}
+
+static int mag_run() {
+    pthread_t t[MagThreads];
+    long ok = 1;
+    for (int k = 0; k < MagThreads; k++) pthread_create(&t[k], NULL, mag_worker, NULL);
+    for (int k = 0; k < MagThreads; k++) {
+        void *r;
+        pthread_join(t[k], &r);
+        ok &= (long)r;
+    }
+    return ok;
+}
+
+static void test_magazines() {
+    test(mag_run(), "Deques on many threads, with slab magazines");
+    test(deq_magazines(0) == 1, "Turning slab magazines off returns the old setting");
+    test(mag_run(), "Deques on many threads, without slab magazines");
+    deq_magazines(1);
+}
+
+/* -------------------------------------------------------------------------
+   Test 28: Operation statistics
+   - Runs a known mix of operations, at both ends
+   - With DEQ_STATS, checks the counts; without, checks they are zero
+   ------------------------------------------------------------------------- */
+static void test_stats() {
+    Deq q = deq_of(deq_new(), "abcde");
+    deq_head_put(q, (Data)(long)'z');
+    deq_head_get(q);
+    deq_tail_get(q);                            // e
+    deq_head_ith(q, 1);
+    deq_head_rem(q, (Data)(long)'c');           // scans a, b, c
+    deq_tail_ith(q, 0);                         // the index outlives the rem
+    deq_tail_rem(q, (Data)(long)'x');           // scans d, b, a
+    DeqStats s;
+    int on = deq_stats(q, &s);
+#ifdef DEQ_STATS
+    test(on == 1, "Statistics are on in a DEQ_STATS build");
+    test(s.puts[0] == 1 && s.puts[1] == 5 && s.gets[0] == 1 && s.gets[1] == 1 &&
+         s.empty_gets[0] == 0 && s.iths[0] == 1 && s.iths[1] == 1 &&
+         s.ith_walk[0] == 4 && s.ith_walk[1] == 0 && s.rem_hits[0] == 1 && s.rem_scan[0] == 3 &&
+         s.rem_misses[1] == 1 && s.rem_scan[1] == 3,
+         "Statistics count each operation by end");
+#else
+    test(on == 0 && s.puts[1] == 0 && s.rem_scan[0] == 0, "Statistics are zero when compiled out");
+#endif
+    deq_del(q, NULL);
+}
+
 /**
  * @brief Main function, runs all tests in sequence and prints a summary.
  */
@@ -315,6 +1376,28 @@ int main(void) {
     test_rem();
     test_map_and_str();
     test_large();
+    test_recycle();
+    test_ith_mixed();
+    test_hash();
+    test_bulk();
+    test_splice();
+    test_split();
+    test_iter();
+    test_map_ctx();
+    test_map_parallel();
+    test_str();
+    test_write();
+    test_str_fmt();
+    test_sync();
+    test_spsc();
+    test_ws();
+    test_mpmc();
+    test_wait();
+    test_lf();
+    test_fc();
+    test_ebr();
+    test_magazines();
+    test_stats();
 
     printf("\n==========================\n");
     printf("Tests run   : %d\n", tests_run);
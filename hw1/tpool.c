@@ -0,0 +1,96 @@
+/**
+ * @file tpool.c
+ * @brief A reusable pool of worker threads, for running data-parallel jobs.
+ *
+ * Workers are created the first time a job needs them, and then sleep on a
+ * condition variable between jobs. A job is a count of parts, and a count of
+ * threads; the caller and that many workers, less one, claim parts one at a
+ * time, until none are left, so a worker that wakes late just finds less (or
+ * no) work. Other workers go back to sleep.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "tpool.h"
+
+#define TPoolMax 256            // most workers ever created
+
+static pthread_mutex_t run=PTHREAD_MUTEX_INITIALIZER; // one job at a time
+static pthread_mutex_t mu=PTHREAD_MUTEX_INITIALIZER;  // guards the rest
+static pthread_cond_t go=PTHREAD_COND_INITIALIZER;    // a job was posted
+static pthread_cond_t done=PTHREAD_COND_INITIALIZER;  // a job finished
+
+static int workers;             // workers created so far
+static unsigned gen;            // number of jobs posted
+static TPoolF jobf;             // the current job
+static void *joba;
+static int jobn;
+static int next;                // next part to claim
+static int pending;             // parts not yet finished
+static int joiners;             // workers that may still join the job
+
+/**
+ * @brief Claims and runs parts of the current job until none are left.
+ *
+ * @note Called, and returns, with mu locked.
+ */
+static void claim() {
+  while (next < jobn) {
+    int k = next++;
+    pthread_mutex_unlock(&mu);
+    jobf(joba, k);
+    pthread_mutex_lock(&mu);
+    if (--pending == 0) pthread_cond_signal(&done);
+  }
+}
+
+// A worker is passed the last generation before the job it was created
+// for, so that it joins that job, however late it starts.
+static void *worker(void *arg) {
+  unsigned seen = (uintptr_t)arg;
+  pthread_mutex_lock(&mu);
+  for (;;) {
+    while (gen == seen) pthread_cond_wait(&go, &mu);
+    seen = gen;
+    if (joiners > 0) {
+      joiners--;
+      claim();
+    }
+  }
+  return 0;
+}
+
+extern void tpool_run(int n, int threads, TPoolF f, void *arg) {
+  if (threads > n) threads = n;
+  if (threads > 1 && pthread_mutex_trylock(&run) == 0) {
+    pthread_mutex_lock(&mu);
+    while (workers < threads - 1 && workers < TPoolMax) {
+      pthread_t t;
+      if (pthread_create(&t, 0, worker, (void *)(uintptr_t)gen)) break;
+      pthread_detach(t);
+      workers++;
+    }
+    jobf = f;
+    joba = arg;
+    jobn = n;
+    next = 0;
+    pending = n;
+    joiners = threads - 1;
+    gen++;
+    pthread_cond_broadcast(&go);
+    claim();
+    while (pending) pthread_cond_wait(&done, &mu);
+    pthread_mutex_unlock(&mu);
+    pthread_mutex_unlock(&run);
+    return;
+  }
+  for (int k = 0; k < n; k++)
+    f(arg, k);
+}
+
+extern int tpool_cpus() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+}
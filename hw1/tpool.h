@@ -0,0 +1,16 @@
+#ifndef TPOOL_H
+#define TPOOL_H
+
+// A process-wide pool of worker threads, created on demand and reused.
+// tpool_run(n,threads,f,arg) calls f(arg,k) for each k in [0,n),
+// spreading the calls over the caller and up to threads-1 workers, and
+// returns when all have returned. The calls may run concurrently, in any order. If the
+// pool is already running a job (e.g., f itself calls tpool_run), the
+// calls are made serially, by the caller, instead.
+
+typedef void (*TPoolF)(void *arg, int k);
+
+extern void tpool_run(int n, int threads, TPoolF f, void *arg);
+extern int  tpool_cpus(); // online CPUs
+
+#endif
@@ -0,0 +1,140 @@
+/**
+ * @file ws.c
+ * @brief A lock-free work-stealing deque (Chase-Lev).
+ *
+ * The owning thread puts and gets at the tail, like a stack, and other
+ * threads steal from the head. Elements live in a circular array, indexed
+ * by ever-increasing head and tail counters; the owner only synchronizes
+ * with thieves when the deque is down to one element. This follows Le,
+ * Pop, Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing for
+ * Weak Memory Models" (PPoPP 2013).
+ *
+ * When the array fills, the owner copies it into one twice the size. A
+ * thief may still be reading the old array, so thieves read it in an
+ * ebr.c critical section, and the owner retires it, rather than freeing it.
+ */
+
+#include <stdlib.h>
+
+#include "ws.h"
+#include "ebr.h"
+#include "error.h"
+
+#define WsMin 64                // initial array size
+
+typedef struct Array {
+  long size;                    // a power of two
+  Data buf[];
+} *Array;
+
+typedef struct {
+  int mode;                     // as in a Rep
+  long head;                    // next to steal; advanced by CAS
+  long tail;                    // next to put; written by the owner only
+  Array array;
+} *Ws;
+
+static Ws ws(Deq q) {
+  if (!q) ERROR("zero pointer");
+  return (Ws)q;
+}
+
+static Array array_new(long size) {
+  Array a=(Array)malloc(sizeof(*a)+size*sizeof(Data));
+  if (!a) ERROR("malloc() failed");
+  a->size=size;
+  return a;
+}
+
+extern Deq ws_new(int mode) {
+  Ws w=(Ws)malloc(sizeof(*w));
+  if (!w) ERROR("malloc() failed");
+  w->mode=mode;
+  w->head=0;
+  w->tail=0;
+  w->array=array_new(WsMin);
+  return w;
+}
+
+/**
+ * @brief Copies the live elements into an array twice the size.
+ *
+ * @param w Pointer to the deque.
+ * @param a The current array.
+ * @param h The head counter, as last read.
+ * @param t The tail counter.
+ * @return The new array, which has been published; the old one is retired.
+ */
+static Array grow(Ws w, Array a, long h, long t) {
+  Array b = array_new(2 * a->size);
+  for (long i = h; i < t; i++)
+    b->buf[i & (b->size - 1)] = __atomic_load_n(&a->buf[i & (a->size - 1)], __ATOMIC_RELAXED);
+  __atomic_store_n(&w->array, b, __ATOMIC_RELEASE);
+  ebr_retire(a, free);
+  ebr_flush();                  // free it now, unless a thief holds it
+  return b;
+}
+
+extern void ws_put(Deq q, Data d) {
+  Ws w = ws(q);
+  long t = __atomic_load_n(&w->tail, __ATOMIC_RELAXED);
+  long h = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+  Array a = __atomic_load_n(&w->array, __ATOMIC_RELAXED);
+  if (t - h > a->size - 1) a = grow(w, a, h, t);
+  __atomic_store_n(&a->buf[t & (a->size - 1)], d, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&w->tail, t + 1, __ATOMIC_RELAXED);
+}
+
+extern Data ws_get(Deq q) {
+  Ws w = ws(q);
+  long t = __atomic_load_n(&w->tail, __ATOMIC_RELAXED) - 1;
+  Array a = __atomic_load_n(&w->array, __ATOMIC_RELAXED);
+  __atomic_store_n(&w->tail, t, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long h = __atomic_load_n(&w->head, __ATOMIC_RELAXED);
+  Data d = 0;
+  if (h <= t) {
+    d = __atomic_load_n(&a->buf[t & (a->size - 1)], __ATOMIC_RELAXED);
+    if (h == t) {
+      // the last element: race thieves for it
+      if (!__atomic_compare_exchange_n(&w->head, &h, h + 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        d = 0;
+      __atomic_store_n(&w->tail, t + 1, __ATOMIC_RELAXED);
+    }
+  } else {
+    __atomic_store_n(&w->tail, t + 1, __ATOMIC_RELAXED);
+  }
+  return d;
+}
+
+extern Data ws_steal(Deq q) {
+  Ws w = ws(q);
+  long h = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long t = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+  if (h >= t) return 0;         // empty
+  ebr_enter();
+  Array a = __atomic_load_n(&w->array, __ATOMIC_ACQUIRE);
+  Data d = __atomic_load_n(&a->buf[h & (a->size - 1)], __ATOMIC_RELAXED);
+  ebr_exit();
+  if (!__atomic_compare_exchange_n(&w->head, &h, h + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return 0;                   // lost a race
+  return d;
+}
+
+extern int ws_len(Deq q) {
+  Ws w = ws(q);
+  long h = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+  long t = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+  return t > h ? t - h : 0;
+}
+
+extern void ws_del(Deq q) {
+  Ws w = ws(q);
+  free(w->array);
+  free(w);
+  ebr_flush();                  // arrays this thread retired
+}
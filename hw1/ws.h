@@ -0,0 +1,17 @@
+#ifndef WS_H
+#define WS_H
+
+#include "deq.h"
+
+// The lock-free work-stealing (Chase-Lev) deque behind deq_ws_new().
+// Like a Rep, it starts with an int mode, which deq.c uses to route
+// deq_tail_put, deq_tail_get, deq_head_steal, deq_len and deq_del here.
+
+extern Deq  ws_new(int mode);
+extern void ws_put(Deq q, Data d);  // owner only, at the tail
+extern Data ws_get(Deq q);          // owner only, from the tail
+extern Data ws_steal(Deq q);        // any thread, from the head
+extern int  ws_len(Deq q);
+extern void ws_del(Deq q);
+
+#endif